@@ -63,6 +63,43 @@ namespace App
 		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 	}
 	
+	void DrawTriangles(const float* xy, const float* rgb, const int count, const bool wireframe)
+	{
+		if (count <= 0) return;
+
+#if APP_USE_VIRTUAL_RES
+		// Same mapping as APP_VIRTUAL_TO_NATIVE_COORDS, done by the fixed-function pipeline so the arrays needn't be copied
+		glMatrixMode(GL_MODELVIEW);
+		glPushMatrix();
+		glTranslatef(-1.0f, -1.0f, 0.0f);
+		glScalef(2.0f / APP_VIRTUAL_WIDTH, 2.0f / APP_VIRTUAL_HEIGHT, 1.0f);
+#endif
+		if (wireframe)
+		{
+			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+		}
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_COLOR_ARRAY);
+		glVertexPointer(2, GL_FLOAT, 0, xy);
+		glColorPointer(3, GL_FLOAT, 0, rgb);
+		glDrawArrays(GL_TRIANGLES, 0, count * 3);
+		glDisableClientState(GL_COLOR_ARRAY);
+		glDisableClientState(GL_VERTEX_ARRAY);
+		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+#if APP_USE_VIRTUAL_RES
+		glPopMatrix();
+#endif
+	}
+
+	void DrawPixels(const int width, const int height, const unsigned int* rgba)
+	{
+		// Raster position is specified in native coordinates, so (-1, -1) is always the bottom-left of the window
+		glRasterPos2f(-1.0f, -1.0f);
+		glPixelZoom(WINDOW_WIDTH / (float)width, WINDOW_HEIGHT / (float)height);
+		glDrawPixels(width, height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+		glPixelZoom(1.0f, 1.0f);
+	}
+	
 	CSimpleSprite *CreateSprite(const char *fileName, const int columns, const int rows)
 	{
 		return new CSimpleSprite(fileName, columns, rows);
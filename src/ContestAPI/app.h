@@ -108,6 +108,22 @@ namespace App
 	//-------------------------------------------------------------------------------------------
 	void DrawTriangle(const float p1x, const float p1y, const float p2x, const float p2y, const float p3x, const float p3y, const float r = 1.0f, const float g = 1.0f, const float b = 1.0f, const bool wireframe = false);
 
+	//-------------------------------------------------------------------------------------------
+	// void DrawTriangles(const float* xy, const float* rgb, const int count, const bool wireframe = false)
+	//-------------------------------------------------------------------------------------------
+	// Draws count 2D Triangles in a single call. xy holds 2 floats (x, y) and rgb holds 3 floats (r, g, b) per vertex, 3 vertices per triangle.
+	// Much faster than calling DrawTriangle for every triangle once there are more than a handful of them.
+	//-------------------------------------------------------------------------------------------
+	void DrawTriangles(const float* xy, const float* rgb, const int count, const bool wireframe = false);
+
+	//-------------------------------------------------------------------------------------------
+	// void DrawPixels(const int width, const int height, const unsigned int* rgba)
+	//-------------------------------------------------------------------------------------------
+	// Draws a width x height block of 32 bit RGBA pixels (8 bits per channel, red in the lowest byte) stretched over the whole window.
+	// Rows are stored bottom to top, so pixel (0, 0) is the bottom-left corner of the window.
+	//-------------------------------------------------------------------------------------------
+	void DrawPixels(const int width, const int height, const unsigned int* rgba);
+
 	//-------------------------------------------------------------------------------------------
 	// void Print(float x, float y, const char *text, float r = 1.0f, float g = 1.0f, float b = 1.0f, void *font = GLUT_BITMAP_HELVETICA_18);
 	//-------------------------------------------------------------------------------------------
@@ -0,0 +1,40 @@
+#include "Clip.h"
+
+static inline Vector4 Lerp4(Vector4 a, Vector4 b, float t)
+{
+	return { a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t };
+}
+
+int ClipNear(const Vector4 in[3], Vector3 out[6])
+{
+	// Sutherland-Hodgman against a single plane turns a triangle into at most a quad
+	Vector4 polygon[4];
+	int count = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		Vector4 a = in[i];
+		Vector4 b = in[(i + 1) % 3];
+		float da = a.z + a.w;
+		float db = b.z + b.w;
+
+		if (da >= 0.0f)
+			polygon[count++] = a;
+		if ((da >= 0.0f) != (db >= 0.0f))
+			polygon[count++] = Lerp4(a, b, da / (da - db));
+	}
+
+	// Every vertex left is on or in front of the near plane so w is positive
+	Vector3 divided[4];
+	for (int i = 0; i < count; i++)
+		divided[i] = { polygon[i].x / polygon[i].w, polygon[i].y / polygon[i].w, polygon[i].z / polygon[i].w };
+
+	int triangles = 0;
+	for (int i = 2; i < count; i++)
+	{
+		out[triangles * 3 + 0] = divided[0];
+		out[triangles * 3 + 1] = divided[i - 1];
+		out[triangles * 3 + 2] = divided[i];
+		triangles++;
+	}
+	return triangles;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include "raymath.h"
+// All "Clip" functions work on clip-space positions, either homogeneous (Vector4) or perspective-divided plus w
+
+enum ClipCode : uint32_t
+{
+	CLIP_LEFT = 1 << 0,
+	CLIP_RIGHT = 1 << 1,
+	CLIP_BOTTOM = 1 << 2,
+	CLIP_TOP = 1 << 3,
+	CLIP_NEAR = 1 << 4,
+	CLIP_FAR = 1 << 5
+};
+
+// Which frustum planes a perspective-divided position (x, y, z) with clip-space w lies outside of.
+// Behind the near plane the divided position is meaningless (w may even be 0), so only CLIP_NEAR is reported there
+inline uint32_t ClipOutcode(float x, float y, float z, float w)
+{
+	if (!(w > 0.0f && z >= -1.0f)) return CLIP_NEAR;
+
+	uint32_t code = 0;
+	code |= x < -1.0f ? (uint32_t)CLIP_LEFT : 0u;
+	code |= x > 1.0f ? (uint32_t)CLIP_RIGHT : 0u;
+	code |= y < -1.0f ? (uint32_t)CLIP_BOTTOM : 0u;
+	code |= y > 1.0f ? (uint32_t)CLIP_TOP : 0u;
+	code |= z > 1.0f ? (uint32_t)CLIP_FAR : 0u;
+	return code;
+}
+
+// Clips a homogeneous triangle to the near plane (z >= -w) and perspective-divides the result.
+// Writes 0, 1 or 2 triangles to out with the input's winding and returns how many
+int ClipNear(const Vector4 in[3], Vector3 out[6]);
@@ -3,7 +3,10 @@
 #endif
 
 #include <cassert>
+#include <chrono>
+#include <cstdio>
 #include "Renderer.h"
+#include "Jobs.h"
 #include "../ContestAPI/app.h"
 
 enum MeshType
@@ -24,16 +27,27 @@ enum ShaderType
 	SHADER_TYPE_COUNT
 };
 
+enum SceneType
+{
+	SCENE_MESH,			// The selected mesh on its own
+	SCENE_OCCLUSION,	// Copies of it behind a wall, culled with the depth pyramid
+	SCENE_CROWD,		// A field of CROWD_SIZE x CROWD_SIZE copies of it
+	SCENE_TYPE_COUNT
+};
+
+constexpr int CROWD_SIZE = 32;
+
 static Mesh meshes[MESH_TYPE_COUNT];
-static FragmentShader shaders[SHADER_TYPE_COUNT];
+static BatchShader shaders[SHADER_TYPE_COUNT];
 static void InitMeshes();
 
 void Init()
 {
+	JobsInit();
 	InitMeshes();
-	shaders[SHADER_POSITIONS] = ShadePositions;
-	shaders[SHADER_NORMALS] = ShadeNormals;
-	shaders[SHADER_PHONG] = ShadePhong;
+	shaders[SHADER_POSITIONS] = ShadePositionsBatch;
+	shaders[SHADER_NORMALS] = ShadeNormalsBatch;
+	shaders[SHADER_PHONG] = ShadePhongBatch;
 }
 
 static float tt = 0.0f;
@@ -82,16 +96,161 @@ void Render()
 		++shader %= 3;
 
 	// KEY_L
-	//if (cont.CheckButton(App::BTN_DPAD_RIGHT))
-	//	wireframe = !wireframe;
+	static int mode = RENDER_MODE_DEPTH;
+	if (cont.CheckButton(App::BTN_DPAD_RIGHT))
+		++mode %= RENDER_MODE_COUNT;
+
+	// KEY_H
+	static int scene = SCENE_MESH;
+	if (cont.CheckButton(App::BTN_Y))
+		++scene %= SCENE_TYPE_COUNT;
+
+	// KEY_T -- draw the crowd with one DrawMeshInstanced call, or with a DrawMesh call per copy to compare
+	static bool instanced = true;
+	if (cont.CheckButton(App::BTN_A))
+		instanced = !instanced;
+
+	// Copies are scaled to the same size whatever the mesh
+	const Mesh& m = meshes[mesh];
+	Matrix fit = MatrixTranslate(-m.bounds_center.x, -m.bounds_center.y, -m.bounds_center.z) * MatrixScale(Vector3Ones * (1.0f / m.bounds_radius));
+	double crowd_ms = 0.0;
+
+	auto draw_scene = [&]()
+	{
+		if (scene == SCENE_MESH)
+		{
+			DrawQueue(m, data, shaders[shader], wireframe);
+			return;
+		}
+
+		if (scene == SCENE_CROWD)
+		{
+			// Rows going back from the camera. Each copy gets its own LOD either way, instanced copies are drawn a LOD at a time
+			static Matrix instances[CROWD_SIZE * CROWD_SIZE];
+			for (int i = 0; i < CROWD_SIZE * CROWD_SIZE; i++)
+				instances[i] = fit * MatrixScale(Vector3Ones * 0.4f) * MatrixTranslate(i % CROWD_SIZE - CROWD_SIZE * 0.5f, 0.0f, 2.0f - i / CROWD_SIZE);
+
+			// Instances are plain world matrices when data's are identity and view * proj
+			UniformData crowd = data;
+			crowd.world = MatrixIdentity();
+			crowd.mvp = view * proj;
+			auto crowd_start = std::chrono::high_resolution_clock::now();
+			if (instanced)
+			{
+				DrawMeshInstanced(m, crowd, instances, CROWD_SIZE * CROWD_SIZE, shaders[shader], wireframe);
+			}
+			else
+			{
+				for (const Matrix& instance : instances)
+				{
+					crowd.world = instance;
+					crowd.mvp = instance * view * proj;
+					DrawMesh(m, crowd, shaders[shader], wireframe);
+				}
+			}
+			crowd_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - crowd_start).count();
+			return;
+		}
+
+		// A wall in front of 3 rows of copies. In depth mode the wall is drawn first and built into the depth pyramid,
+		// so the copies hidden behind it are culled before any of their faces are transformed
+		UniformData wall = data;
+		wall.world = MatrixScale({ 16.0f, 5.5f, 1.0f }) * MatrixTranslate(0.0f, 0.25f, 3.5f);
+		wall.mvp = wall.world * view * proj;
+		wall.object_color = Vector3Ones * 0.5f;
+		DrawQueue(meshes[MESH_PLANE], wall, shaders[shader], wireframe);
+
+		// Painter's modes have no depth buffer to build from, and flushing the wall early would draw the copies over it
+		if (mode == RENDER_MODE_DEPTH)
+			DrawBuildOcclusion();
 
-	DrawMesh(meshes[mesh], data, shaders[shader], wireframe);
+		for (int row = 0; row < 3; row++)
+		{
+			for (int column = -1; column <= 1; column++)
+			{
+				UniformData copy = data;
+				copy.world = fit * MatrixTranslate(column * 3.0f, 0.0f, row * -3.0f);
+				copy.mvp = copy.world * view * proj;
+				DrawQueue(m, copy, shaders[shader], wireframe);
+			}
+		}
+	};
+
+	DrawSetMode((RenderMode)mode);
+	DrawBegin();
+	draw_scene();
+	DrawEnd();
+
+	// Mouse picking -- the inverse of mvp takes the cursor's points on the near and far planes straight into the mesh's local space.
+	// GLUT measures the mouse from the top of the window, so y is flipped. data.mvp only places the mesh drawn on its own,
+	// so the other scenes don't pick
+	MeshHit hit;
+	bool picked = false;
+	double pick_us = 0.0;
+	if (scene == SCENE_MESH)
+	{
+		float mouse_x, mouse_y;
+		App::GetMousePos(mouse_x, mouse_y);
+#if APP_USE_VIRTUAL_RES
+		APP_VIRTUAL_TO_NATIVE_COORDS(mouse_x, mouse_y);
+#endif
+		Matrix unproject = MatrixInvert(data.mvp);
+		Vector4 near_point = Vector4{ mouse_x, -mouse_y, -1.0f, 1.0f } * unproject;
+		Vector4 far_point = Vector4{ mouse_x, -mouse_y, 1.0f, 1.0f } * unproject;
+		Vector3 ray_start = Vector3{ near_point.x, near_point.y, near_point.z } / near_point.w;
+		Vector3 ray_end = Vector3{ far_point.x, far_point.y, far_point.z } / far_point.w;
+
+		auto pick_start = std::chrono::high_resolution_clock::now();
+		picked = MeshRaycast(meshes[mesh], ray_start, ray_end - ray_start, 1.0f, &hit);
+		pick_us = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - pick_start).count();
+	}
+
+	const RenderStats& stats = DrawGetStats();
+	char text[128];
+	snprintf(text, sizeof(text), "Renderer allocations: %zu this frame, %zu total (%zu KB). Draw calls: %zu",
+		stats.frame_allocations, stats.total_allocations, stats.workspace_bytes / 1024, stats.frame_draw_calls);
+	App::Print(-0.98f, 0.95f, text, 1.0f, 1.0f, 1.0f, GLUT_BITMAP_HELVETICA_10);
+	snprintf(text, sizeof(text), "Faces: %zu visible of %zu, %zu clipped. Painter's sorts: %zu full, %zu repaired",
+		stats.frame_faces_visible, stats.frame_faces, stats.frame_faces_clipped, stats.sorts_full, stats.sorts_repaired);
+	App::Print(-0.98f, 0.91f, text, 1.0f, 1.0f, 1.0f, GLUT_BITMAP_HELVETICA_10);
+	snprintf(text, sizeof(text), "Meshes: %zu drawn (%zu queued), %zu culled, %zu at a lower LOD. Meshlets: %zu of %zu culled", stats.frame_meshes, stats.frame_meshes_queued, stats.frame_meshes_culled, stats.frame_meshes_lod, stats.frame_meshlets_culled, stats.frame_meshlets);
+	App::Print(-0.98f, 0.87f, text, 1.0f, 1.0f, 1.0f, GLUT_BITMAP_HELVETICA_10);
+	snprintf(text, sizeof(text), "Transform cache: %zu hits, %zu misses. Vertices transformed: %zu", stats.frame_transform_hits, stats.frame_transform_misses, stats.frame_vertices);
+	App::Print(-0.98f, 0.83f, text, 1.0f, 1.0f, 1.0f, GLUT_BITMAP_HELVETICA_10);
+	if (scene != SCENE_MESH)
+		snprintf(text, sizeof(text), "Mouse: picking is only done with the mesh on its own");
+	else if (picked)
+		snprintf(text, sizeof(text), "Mouse: face %u at (%.2f, %.2f, %.2f), picked in %.1f us", hit.face, hit.position.x, hit.position.y, hit.position.z, pick_us);
+	else
+		snprintf(text, sizeof(text), "Mouse: nothing, picked in %.1f us", pick_us);
+	App::Print(-0.98f, 0.79f, text, 1.0f, 1.0f, 1.0f, GLUT_BITMAP_HELVETICA_10);
+	if (scene == SCENE_CROWD)
+	{
+		snprintf(text, sizeof(text), "Crowd: %d copies drawn %s in %.2f ms", CROWD_SIZE * CROWD_SIZE,
+			instanced ? "by one DrawMeshInstanced call" : "by a DrawMesh call each", crowd_ms);
+		App::Print(-0.98f, 0.75f, text, 1.0f, 1.0f, 1.0f, GLUT_BITMAP_HELVETICA_10);
+	}
+
+	// KEY_G -- render the same frame into a CPU framebuffer and save it. Done last, since the capture's DrawBegin resets the stats printed above
+	if (cont.CheckButton(App::BTN_X))
+	{
+		static Framebuffer capture;
+		if (capture.width != APP_VIRTUAL_WIDTH || capture.height != APP_VIRTUAL_HEIGHT)
+			FramebufferCreate(&capture, APP_VIRTUAL_WIDTH, APP_VIRTUAL_HEIGHT);
+		DrawSetTarget(&capture);
+		DrawBegin();
+		draw_scene();
+		DrawEnd();
+		DrawSetTarget(nullptr);
+		FramebufferSaveBMP(capture, "capture.bmp");
+	}
 }
 
 void Shutdown()
 {
 	for (int i = 0; i < MESH_TYPE_COUNT; i++)
 		MeshUnload(&meshes[i]);
+	JobsShutdown();
 }
 
 void InitMeshes()
@@ -107,6 +266,10 @@ void InitMeshes()
 
 		m.normals.resize(m.face_count);
 		m.normals[0] = Vector3UnitZ;
+
+		MeshBuildSoA(&m);
+		MeshComputeBounds(&m);
+		MeshBuildBvh(&m);
 	}
 
 	{
@@ -124,12 +287,19 @@ void InitMeshes()
 		};
 
 		MeshTriangulate(&meshes[MESH_PLANE], positions, indices);
+		MeshBuildBvh(&meshes[MESH_PLANE]);
 	}
 
 	MeshImport(&meshes[MESH_SPHERE], "./data/TestData/sphere.vbo_nxt");
 	MeshImport(&meshes[MESH_HEAD], "./data/TestData/head.vbo_nxt");
 	MeshImport(&meshes[MESH_CT4], "./data/TestData/ct4.vbo_nxt");
 
+	// The largest mesh is drawn from the compact layout, which streams well under half the bytes per frame.
+	// Its meshlets and BVH came with it from MeshImport, since quantizing releases the float copies they're built from
+	MeshQuantize(&meshes[MESH_CT4]);
+	for (Mesh& lod : meshes[MESH_CT4].lods)
+		MeshQuantize(&lod);
+
 	// Initialization sanity-check
 	for (int i = 0; i < MESH_TYPE_COUNT; i++)
 		assert(meshes[i].face_count > 0);
@@ -0,0 +1,207 @@
+#include "Jobs.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Each thread owns a range of chunk indices packed as (begin << 32 | end), so the owner popping from the front
+// and a thief splitting off the back are both a single compare-exchange. Padded so threads don't share cache lines.
+struct alignas(64) ChunkRange
+{
+	std::atomic<uint64_t> range{ 0 };
+};
+
+struct JobSystem
+{
+	std::vector<std::thread> workers;
+	std::unique_ptr<ChunkRange[]> ranges;	// One per thread, index 0 is the thread calling JobsParallelFor
+	int thread_count = 1;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	uint64_t generation = 0;
+	bool quit = false;
+
+	// Current job, written before generation is incremented
+	JobFunction job = nullptr;
+	void* user = nullptr;
+	size_t count = 0;
+	size_t chunk_size = 0;
+
+	// Chunks of the current job not yet finished. JobsParallelFor returns as soon as this is 0, without waiting for workers
+	// that haven't woken yet -- they find every range empty
+	std::atomic<size_t> remaining{ 0 };
+
+	// Workers between waking up and going back to sleep. The next job isn't dealt out until this is 0 (with the mutex held, so no
+	// worker can wake in between), so no worker is still scanning the ranges when they're overwritten
+	std::atomic<int> active{ 0 };
+
+	// Workers must be joined before the condition variable they sleep on is destroyed, even if Shutdown is never reached
+	~JobSystem();
+};
+
+static JobSystem jobs;
+
+JobSystem::~JobSystem()
+{
+	if (!workers.empty())
+		JobsShutdown();
+}
+
+static inline uint64_t RangePack(uint32_t begin, uint32_t end)
+{
+	return ((uint64_t)begin << 32) | end;
+}
+
+static bool ChunkPop(int self, uint32_t* chunk)
+{
+	std::atomic<uint64_t>& range = jobs.ranges[self].range;
+	uint64_t value = range.load(std::memory_order_acquire);
+	for (;;)
+	{
+		uint32_t begin = (uint32_t)(value >> 32);
+		uint32_t end = (uint32_t)value;
+		if (begin >= end) return false;
+
+		if (range.compare_exchange_weak(value, RangePack(begin + 1, end), std::memory_order_acq_rel))
+		{
+			*chunk = begin;
+			return true;
+		}
+	}
+}
+
+static bool ChunkSteal(int self, uint32_t* chunk)
+{
+	for (int i = 1; i < jobs.thread_count; i++)
+	{
+		int victim = (self + i) % jobs.thread_count;
+		std::atomic<uint64_t>& range = jobs.ranges[victim].range;
+		uint64_t value = range.load(std::memory_order_acquire);
+		for (;;)
+		{
+			uint32_t begin = (uint32_t)(value >> 32);
+			uint32_t end = (uint32_t)value;
+			if (begin >= end) break;
+
+			// Take the back half, leaving the victim the chunks closest to the ones it's working on
+			uint32_t mid = begin + (end - begin) / 2;
+			if (range.compare_exchange_weak(value, RangePack(begin, mid), std::memory_order_acq_rel))
+			{
+				*chunk = mid;
+				jobs.ranges[self].range.store(RangePack(mid + 1, end), std::memory_order_release);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static void JobsWork(int self)
+{
+	uint32_t chunk;
+	while (ChunkPop(self, &chunk) || ChunkSteal(self, &chunk))
+	{
+		size_t begin = chunk * jobs.chunk_size;
+		size_t end = std::min(begin + jobs.chunk_size, jobs.count);
+		jobs.job(jobs.user, begin, end, self);
+		jobs.remaining.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+static void WorkerMain(int self)
+{
+	uint64_t seen = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(jobs.mutex);
+			jobs.wake.wait(lock, [&] { return jobs.quit || jobs.generation != seen; });
+			if (jobs.quit) return;
+			seen = jobs.generation;
+			jobs.active.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		JobsWork(self);
+		jobs.active.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+void JobsInit(int worker_count)
+{
+	if (!jobs.workers.empty()) return;
+
+	if (worker_count < 0)
+		worker_count = std::max((int)std::thread::hardware_concurrency() - 1, 0);
+
+	jobs.thread_count = worker_count + 1;
+	jobs.ranges.reset(new ChunkRange[jobs.thread_count]);
+	jobs.quit = false;
+	for (int i = 1; i < jobs.thread_count; i++)
+		jobs.workers.emplace_back(WorkerMain, i);
+}
+
+void JobsShutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(jobs.mutex);
+		jobs.quit = true;
+	}
+	jobs.wake.notify_all();
+
+	for (std::thread& worker : jobs.workers)
+		worker.join();
+
+	jobs.workers.clear();
+	jobs.ranges.reset();
+	jobs.thread_count = 1;
+}
+
+int JobsThreadCount()
+{
+	return jobs.thread_count;
+}
+
+void JobsParallelFor(size_t count, size_t chunk_size, JobFunction job, void* user)
+{
+	if (count == 0) return;
+
+	chunk_size = std::max<size_t>(chunk_size, 1);
+	size_t chunk_count = (count + chunk_size - 1) / chunk_size;
+	if (jobs.thread_count == 1 || chunk_count == 1)
+	{
+		for (size_t begin = 0; begin < count; begin += chunk_size)
+			job(user, begin, std::min(begin + chunk_size, count), 0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(jobs.mutex);
+		while (jobs.active.load(std::memory_order_acquire) != 0)
+			std::this_thread::yield();
+
+		jobs.job = job;
+		jobs.user = user;
+		jobs.count = count;
+		jobs.chunk_size = chunk_size;
+		jobs.remaining.store(chunk_count, std::memory_order_relaxed);
+
+		// Deal chunks out evenly up-front so stealing is only needed to even out imbalance
+		for (int t = 0; t < jobs.thread_count; t++)
+		{
+			uint32_t begin = (uint32_t)(chunk_count * t / jobs.thread_count);
+			uint32_t end = (uint32_t)(chunk_count * (t + 1) / jobs.thread_count);
+			jobs.ranges[t].range.store(RangePack(begin, end), std::memory_order_relaxed);
+		}
+		jobs.generation++;
+	}
+	jobs.wake.notify_all();
+
+	JobsWork(0);
+	while (jobs.remaining.load(std::memory_order_acquire) != 0)
+		std::this_thread::yield();
+}
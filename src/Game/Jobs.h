@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <type_traits>
+// All "Jobs" functions are safe to call from the main thread only.
+// Worker threads are started by JobsInit; until then (or with 0 workers) every job simply runs on the calling thread.
+
+// Processes items [begin, end). worker is in [0, JobsThreadCount()) and can be used to index per-thread scratch data
+using JobFunction = void(*)(void* user, size_t begin, size_t end, int worker);
+
+void JobsInit(int worker_count = -1);	// -1 = one worker per hardware thread, minus the main thread
+void JobsShutdown();
+
+// Threads that can run a job at once, including the calling thread
+int JobsThreadCount();
+
+// Splits [0, count) into chunks of chunk_size items and blocks until every chunk has been processed.
+// Each call to job covers exactly one chunk, so begin / chunk_size identifies it (ie for per-chunk outputs).
+// Chunks are dealt out evenly up-front; threads that run out of work steal half of the remaining chunks from another thread.
+void JobsParallelFor(size_t count, size_t chunk_size, JobFunction job, void* user);
+
+// Convenience overload for lambdas. f(begin, end, worker) -- the lambda is referenced, not copied, so nothing is allocated
+template<typename F>
+inline void JobsParallelFor(size_t count, size_t chunk_size, F&& f)
+{
+	using Func = typename std::remove_reference<F>::type;
+	JobFunction job = [](void* user, size_t begin, size_t end, int worker)
+	{
+		(*(Func*)user)(begin, end, worker);
+	};
+	JobsParallelFor(count, chunk_size, job, (void*)&f);
+}
@@ -1,32 +1,25 @@
 #include "Mesh.h"
-#include <fstream>
+#include <atomic>
+#include <cstring>
+#include <unordered_map>
 
-void MeshImport(Mesh* mesh, const char* filename)
+// Generations count up across every mesh, so a mesh loaded where another was unloaded never matches a generation cached for it
+void MeshMarkChanged(Mesh* mesh)
 {
-	std::ifstream in;
-	in.open(filename, std::ios::binary);
-
-	size_t position_count = 0;
-	size_t index_count = 0;
-	in.read((char*)&position_count, sizeof(position_count));
-	in.read((char*)&index_count, sizeof(index_count));
-
-	std::vector<Vector3> positions;
-	std::vector<uint16_t> indices;
-	positions.resize(position_count);
-	indices.resize(index_count);
-
-	in.read((char*)positions.data(), sizeof(Vector3) * position_count);
-	in.read((char*)indices.data(), sizeof(Vector3) * index_count);
-	in.close();
-
-	MeshTriangulate(mesh, positions, indices);
+	static std::atomic<uint64_t> generations{ 0 };
+	mesh->generation = ++generations;
 }
 
 void MeshTriangulate(Mesh* mesh, const std::vector<Vector3>& positions, const std::vector<uint16_t>& indices)
 {
-	mesh->face_count = indices.size() / 3;
-	mesh->positions.resize(indices.size());
+	MeshTriangulate(mesh, positions.data(), indices.data(), indices.size());
+}
+
+template<typename Index>
+static void Triangulate(Mesh* mesh, const Vector3* positions, const Index* indices, size_t index_count)
+{
+	mesh->face_count = index_count / 3;
+	mesh->positions.resize(index_count);
 	mesh->normals.resize(mesh->face_count);
 
 	for (size_t f = 0; f < mesh->face_count; f++)
@@ -42,11 +35,286 @@ void MeshTriangulate(Mesh* mesh, const std::vector<Vector3>& positions, const st
 		mesh->positions[v + 2] = v2;
 		mesh->normals[f] = n;
 	}
+
+	mesh->meshlets.clear();
+	mesh->bvh_nodes.clear();
+	mesh->bvh_faces.clear();
+	MeshBuildSoA(mesh);
+	MeshComputeBounds(mesh);
+}
+
+void MeshTriangulate(Mesh* mesh, const Vector3* positions, const uint16_t* indices, size_t index_count)
+{
+	Triangulate(mesh, positions, indices, index_count);
+}
+
+void MeshTriangulate(Mesh* mesh, const Vector3* positions, const uint32_t* indices, size_t index_count)
+{
+	Triangulate(mesh, positions, indices, index_count);
+}
+
+// Zero-padded copies of positions' components
+static void BuildStreams(const Vector3* positions, size_t count, std::vector<float>* x, std::vector<float>* y, std::vector<float>* z)
+{
+	size_t padded = (count + TRANSFORM_SIMD_WIDTH - 1) / TRANSFORM_SIMD_WIDTH * TRANSFORM_SIMD_WIDTH;
+	x->assign(padded, 0.0f);
+	y->assign(padded, 0.0f);
+	z->assign(padded, 0.0f);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		(*x)[i] = positions[i].x;
+		(*y)[i] = positions[i].y;
+		(*z)[i] = positions[i].z;
+	}
+}
+
+// Releases the vectors' memory, not just their contents
+template<typename T>
+static void Release(std::vector<T>* v)
+{
+	std::vector<T>().swap(*v);
+}
+
+// MeshQuantize released the float normals, so they're decoded again before the encoded ones go
+static void ReleaseQuantized(Mesh* mesh)
+{
+	if (mesh->normals.empty() && (!mesh->normals_oct_8.empty() || !mesh->normals_oct_16.empty()))
+	{
+		mesh->normals.resize(mesh->face_count);
+		for (size_t f = 0; f < mesh->face_count; f++)
+		{
+			Vector3 n = !mesh->normals_oct_16.empty() ? MeshDecodeNormal16(mesh->normals_oct_16[f]) : MeshDecodeNormal8(mesh->normals_oct_8[f]);
+			mesh->normals[f] = Vector3Normalize(n);
+		}
+	}
+	Release(&mesh->quantized_x);
+	Release(&mesh->quantized_y);
+	Release(&mesh->quantized_z);
+	Release(&mesh->normals_oct_8);
+	Release(&mesh->normals_oct_16);
+	mesh->dequantize = MatrixIdentity();
+}
+
+void MeshBuildSoA(Mesh* mesh)
+{
+	BuildStreams(mesh->positions.data(), mesh->positions.size(), &mesh->soa_x, &mesh->soa_y, &mesh->soa_z);
+
+	mesh->vertex_count = 0;
+	Release(&mesh->vertex_x);
+	Release(&mesh->vertex_y);
+	Release(&mesh->vertex_z);
+	Release(&mesh->indices_16);
+	Release(&mesh->indices_32);
+	ReleaseQuantized(mesh);
+	MeshMarkChanged(mesh);
+}
+
+void MeshBuildIndexed(Mesh* mesh)
+{
+	std::vector<Vector3> vertices;
+	std::vector<uint32_t> indices;
+	MeshWeld(*mesh, &vertices, &indices);
+	MeshSetIndexed(mesh, vertices.data(), vertices.size(), indices.data(), indices.size());
+}
+
+template<typename Index>
+static void SetIndexed(Mesh* mesh, const Vector3* vertices, size_t vertex_count, const Index* indices, size_t index_count)
+{
+	BuildStreams(vertices, vertex_count, &mesh->vertex_x, &mesh->vertex_y, &mesh->vertex_z);
+	mesh->vertex_count = vertex_count;
+
+	if (vertex_count <= UINT16_MAX + 1)
+	{
+		mesh->indices_16.assign(indices, indices + index_count);
+		Release(&mesh->indices_32);
+	}
+	else
+	{
+		mesh->indices_32.assign(indices, indices + index_count);
+		Release(&mesh->indices_16);
+	}
+
+	Release(&mesh->soa_x);
+	Release(&mesh->soa_y);
+	Release(&mesh->soa_z);
+	ReleaseQuantized(mesh);
+	MeshMarkChanged(mesh);
+}
+
+void MeshSetIndexed(Mesh* mesh, const Vector3* vertices, size_t vertex_count, const uint16_t* indices, size_t index_count)
+{
+	SetIndexed(mesh, vertices, vertex_count, indices, index_count);
+}
+
+void MeshSetIndexed(Mesh* mesh, const Vector3* vertices, size_t vertex_count, const uint32_t* indices, size_t index_count)
+{
+	SetIndexed(mesh, vertices, vertex_count, indices, index_count);
+}
+
+// Nearest of the 2 * scale + 1 steps across [-1, 1]
+static int QuantizeSnorm(float x, float scale)
+{
+	return (int)roundf(fminf(fmaxf(x, -1.0f), 1.0f) * scale);
+}
+
+// Projects n onto the octahedron |x| + |y| + |z| = 1, then unfolds the lower half over the corners of the upper one
+static Vector2 EncodeOctahedral(Vector3 n)
+{
+	float length = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	if (!(length > 0.0f)) return Vector2Zeros;
+
+	Vector2 p = { n.x / length, n.y / length };
+	if (n.z < 0.0f)
+	{
+		p = {
+			(1.0f - fabsf(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f),
+			(1.0f - fabsf(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f) };
+	}
+	return p;
+}
+
+void MeshQuantize(Mesh* mesh, int normal_bits)
+{
+	if (mesh->vertex_x.empty())
+		MeshBuildIndexed(mesh);
+
+	// Each axis of the box is split into 65535 steps. Flat axes have no steps and everything on them quantizes to 0
+	Vector3 lo = { INFINITY, INFINITY, INFINITY };
+	Vector3 hi = { -INFINITY, -INFINITY, -INFINITY };
+	for (size_t i = 0; i < mesh->vertex_count; i++)
+	{
+		Vector3 p = { mesh->vertex_x[i], mesh->vertex_y[i], mesh->vertex_z[i] };
+		lo = Vector3Min(lo, p);
+		hi = Vector3Max(hi, p);
+	}
+	Vector3 step = (hi - lo) / 65535.0f;
+	auto quantize = [](float p, float lo, float step)
+	{
+		return step > 0.0f ? (uint16_t)fminf(roundf((p - lo) / step), 65535.0f) : (uint16_t)0;
+	};
+
+	size_t padded = mesh->vertex_x.size();
+	mesh->quantized_x.assign(padded, 0);
+	mesh->quantized_y.assign(padded, 0);
+	mesh->quantized_z.assign(padded, 0);
+	for (size_t i = 0; i < mesh->vertex_count; i++)
+	{
+		mesh->quantized_x[i] = quantize(mesh->vertex_x[i], lo.x, step.x);
+		mesh->quantized_y[i] = quantize(mesh->vertex_y[i], lo.y, step.y);
+		mesh->quantized_z[i] = quantize(mesh->vertex_z[i], lo.z, step.z);
+	}
+	mesh->dequantize = MatrixScale(step) * MatrixTranslate(lo);
+
+	mesh->normals_oct_8.clear();
+	mesh->normals_oct_16.clear();
+	for (const Vector3& n : mesh->normals)
+	{
+		Vector2 p = EncodeOctahedral(n);
+		if (normal_bits == 8)
+			mesh->normals_oct_8.push_back((uint16_t)((QuantizeSnorm(p.x, 127.0f) & 0xFF) | (QuantizeSnorm(p.y, 127.0f) & 0xFF) << 8));
+		else
+			mesh->normals_oct_16.push_back((uint32_t)(QuantizeSnorm(p.x, 32767.0f) & 0xFFFF) | (uint32_t)(QuantizeSnorm(p.y, 32767.0f) & 0xFFFF) << 16);
+	}
+
+	// Only the compact copy is kept, or the mesh would end up larger than it started
+	Release(&mesh->positions);
+	Release(&mesh->normals);
+	Release(&mesh->vertex_x);
+	Release(&mesh->vertex_y);
+	Release(&mesh->vertex_z);
+	MeshMarkChanged(mesh);
+}
+
+void MeshComputeBounds(Mesh* mesh)
+{
+	mesh->bounds_min = { INFINITY, INFINITY, INFINITY };
+	mesh->bounds_max = { -INFINITY, -INFINITY, -INFINITY };
+	size_t corner_count = mesh->face_count * 3;
+	for (size_t i = 0; i < corner_count; i++)
+	{
+		Vector3 p = MeshCorner(*mesh, i);
+		mesh->bounds_min = Vector3Min(mesh->bounds_min, p);
+		mesh->bounds_max = Vector3Max(mesh->bounds_max, p);
+	}
+
+	// Centered on the box, which is cheap and never far off the smallest sphere for the compact meshes drawn here
+	mesh->bounds_center = (mesh->bounds_min + mesh->bounds_max) * 0.5f;
+	mesh->bounds_radius = 0.0f;
+	for (size_t i = 0; i < corner_count; i++)
+		mesh->bounds_radius = fmaxf(mesh->bounds_radius, Vector3Distance(mesh->bounds_center, MeshCorner(*mesh, i)));
+}
+
+void MeshExpandPositions(Mesh* mesh)
+{
+	if (!mesh->positions.empty()) return;
+	std::vector<Vector3> positions(mesh->face_count * 3);
+	for (size_t i = 0; i < positions.size(); i++)
+		positions[i] = MeshCorner(*mesh, i);
+	mesh->positions.swap(positions);
+}
+
+struct PositionHash
+{
+	size_t operator()(const Vector3& p) const
+	{
+		uint32_t bits[3];
+		memcpy(bits, &p, sizeof(bits));
+		return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+	}
+};
+
+struct PositionEqual
+{
+	bool operator()(const Vector3& a, const Vector3& b) const
+	{
+		return a.x == b.x && a.y == b.y && a.z == b.z;
+	}
+};
+
+void MeshWeld(const Mesh& mesh, std::vector<Vector3>* positions, std::vector<uint32_t>* indices)
+{
+	std::unordered_map<Vector3, uint32_t, PositionHash, PositionEqual> welded;
+	positions->clear();
+	indices->resize(mesh.face_count * 3);
+	for (size_t i = 0; i < indices->size(); i++)
+	{
+		Vector3 p = MeshCorner(mesh, i);
+		auto it = welded.emplace(p, (uint32_t)positions->size());
+		if (it.second)
+			positions->push_back(p);
+		(*indices)[i] = it.first->second;
+	}
 }
 
 void MeshUnload(Mesh* mesh)
 {
 	mesh->positions.resize(0);
 	mesh->normals.resize(0);
+	mesh->soa_x.resize(0);
+	mesh->soa_y.resize(0);
+	mesh->soa_z.resize(0);
+	mesh->vertex_count = 0;
+	mesh->vertex_x.resize(0);
+	mesh->vertex_y.resize(0);
+	mesh->vertex_z.resize(0);
+	mesh->indices_16.resize(0);
+	mesh->indices_32.resize(0);
+	mesh->quantized_x.resize(0);
+	mesh->quantized_y.resize(0);
+	mesh->quantized_z.resize(0);
+	mesh->dequantize = MatrixIdentity();
+	mesh->normals_oct_8.resize(0);
+	mesh->normals_oct_16.resize(0);
+	mesh->bounds_min = { INFINITY, INFINITY, INFINITY };
+	mesh->bounds_max = { -INFINITY, -INFINITY, -INFINITY };
+	mesh->bounds_center = Vector3Zeros;
+	mesh->bounds_radius = -1.0f;
+	mesh->meshlets.clear();
+	mesh->bvh_nodes.clear();
+	mesh->bvh_faces.clear();
+	mesh->lods.clear();
+	mesh->lod_error = 0.0f;
 	mesh->face_count = 0;
+	MeshMarkChanged(mesh);
 }
@@ -2,14 +2,180 @@
 #include <cstdint>
 #include <vector>
 #include "raymath.h"
+#include "Transform.h"
+
+// Faces per Meshlet. Keeps every meshlet's vertices on a SIMD boundary of the transform kernels
+constexpr size_t MESH_MESHLET_FACES = 64;
+
+// Bounds of a cluster of neighbouring faces, so DrawMesh can cull them all with one test
+struct Meshlet
+{
+	Vector3 center;		// Local-space bounding sphere
+	float radius;
+	Vector3 cone_axis;	// Average of the faces' normals
+	float cone_cutoff;	// Sine of the widest angle between cone_axis and a face normal, 1 if the faces point too many ways to cull
+};
+
+// Bounding volume hierarchy node. Nodes are stored depth-first, so an interior node's first child directly follows it
+struct BvhNode
+{
+	Vector3 bounds_min;
+	uint32_t first;		// Leaves: index of the first face in Mesh::bvh_faces. Interior nodes: index of the second child
+	Vector3 bounds_max;
+	uint32_t count;		// Faces in a leaf, 0 for interior nodes
+};
+
+// Closest intersection found by MeshRaycast
+struct MeshHit
+{
+	float t;			// Hit position is origin + direction * t
+	uint32_t face;
+	Vector3 position;	// Local space
+};
 
 struct Mesh
 {
 	size_t face_count = 0;
-	std::vector<Vector3> positions;	// size is face_count * 3
-	std::vector<Vector3> normals;	// size is face_count
+	// Every face's own copy of its corners, size face_count * 3. Indexed meshes don't need them and MeshImport leaves them empty,
+	// so corners are read with MeshCorner, which falls back on the indexed copy. MeshExpandPositions brings them back
+	std::vector<Vector3> positions;
+	std::vector<Vector3> normals;	// size is face_count, empty once MeshQuantize has encoded them
+
+	// Structure-of-arrays copy of positions for the SIMD transform kernels.
+	// Zero-padded to a multiple of TRANSFORM_SIMD_WIDTH. Empty if MeshBuildSoA hasn't been called, in which case DrawMesh transforms positions one at a time
+	// (unless the mesh is indexed)
+	std::vector<float> soa_x;
+	std::vector<float> soa_y;
+	std::vector<float> soa_z;
+
+	// Indexed copy of the faces: every distinct position once, in structure-of-arrays padded like soa_x, and 3 indices per face into them.
+	// indices_16 when there are at most 65536 vertices, otherwise indices_32 (the other is empty). Empty unless MeshBuildIndexed has been called,
+	// in which case DrawMesh transforms each vertex once rather than once per face using it. soa_x and the indexed copy are never both kept
+	size_t vertex_count = 0;
+	std::vector<float> vertex_x;
+	std::vector<float> vertex_y;
+	std::vector<float> vertex_z;
+	std::vector<uint16_t> indices_16;
+	std::vector<uint32_t> indices_32;
+
+	// Compact copy of the indexed vertices, replacing vertex_x: each component is 0 to 65535 across the vertices' bounding box, and dequantize
+	// takes them back to local space. Face normals are octahedral-encoded, 2 8-bit components in normals_oct_8 or 2 16-bit ones in normals_oct_16
+	// (the other is empty). Empty unless MeshQuantize has been called, in which case these replace vertex_x and normals
+	std::vector<uint16_t> quantized_x;
+	std::vector<uint16_t> quantized_y;
+	std::vector<uint16_t> quantized_z;
+	Matrix dequantize = MatrixIdentity();
+	std::vector<uint16_t> normals_oct_8;
+	std::vector<uint32_t> normals_oct_16;
+
+	// Local-space bounding box, empty (min > max) until MeshComputeBounds has been called. DrawMesh culls whole meshes with it
+	Vector3 bounds_min = { INFINITY, INFINITY, INFINITY };
+	Vector3 bounds_max = { -INFINITY, -INFINITY, -INFINITY };
+	Vector3 bounds_center = Vector3Zeros;	// Local-space bounding sphere around the box's center, radius -1 until MeshComputeBounds has been called
+	float bounds_radius = -1.0f;
+
+	// Meshlet i covers faces [i * MESH_MESHLET_FACES, (i + 1) * MESH_MESHLET_FACES). Empty unless MeshBuildMeshlets has been called
+	std::vector<Meshlet> meshlets;
+
+	// Hierarchy over the faces for MeshRaycast. Empty unless MeshBuildBvh has been called
+	std::vector<BvhNode> bvh_nodes;
+	std::vector<uint32_t> bvh_faces;	// Face indices, each leaf covers a contiguous range
+
+	// Simplified copies of this mesh, each with about half the faces of the one before. Empty unless MeshBuildLods has been called
+	std::vector<Mesh> lods;
+	float lod_error = 0.0f;	// How far (in local space) this LOD's surface may be from the original's, 0 for the original
+
+	// New every time the vertices change (see MeshMarkChanged), and never reused by another mesh. DrawMesh keys its transform cache on it
+	uint64_t generation = 0;
 };
 
-void MeshImport(Mesh* mesh, const char* filename);
+// Local-space position of corner (face * 3 + 0, 1 or 2). From positions if the mesh kept them, otherwise through the indexed copy
+inline Vector3 MeshCorner(const Mesh& mesh, size_t corner)
+{
+	if (!mesh.positions.empty()) return mesh.positions[corner];
+	size_t v = !mesh.indices_16.empty() ? mesh.indices_16[corner] : mesh.indices_32[corner];
+	if (!mesh.quantized_x.empty())
+		return Vector3{ (float)mesh.quantized_x[v], (float)mesh.quantized_y[v], (float)mesh.quantized_z[v] } * mesh.dequantize;
+	return Vector3{ mesh.vertex_x[v], mesh.vertex_y[v], mesh.vertex_z[v] };
+}
+
+constexpr size_t MESH_LOD_MIN_FACES = 64;	// No LOD is built below this many faces
+constexpr int MESH_LOD_MAX_LEVELS = 8;
+
+// Loads a .vbo_nxt file, either version (see MeshFile.cpp). Returns false, leaving mesh untouched, if it can't be read or fails validation.
+// Version 1 files get LODs, meshlets, the indexed copy and a BVH built here, version 2 files (see MeshCook) already hold them.
+// Either way the mesh and its LODs are left indexed without positions
+bool MeshImport(Mesh* mesh, const char* filename);
+
+// Writes mesh, its LODs and its BVH as a version 2 .vbo_nxt file. Returns false unless mesh and every LOD have the full precision indexed copy
+// (see MeshBuildIndexed)
+bool MeshExport(const char* filename, const Mesh& mesh);
+
+// Rebuilds positions from the indexed copy, for code that wants every corner in one array. Costs 36 bytes a face
+void MeshExpandPositions(Mesh* mesh);
+
+// Gives mesh a new generation. Every Mesh* function that changes the vertices calls it; code that edits them directly must call it too
+void MeshMarkChanged(Mesh* mesh);
+
 void MeshTriangulate(Mesh* mesh, const std::vector<Vector3>& positions, const std::vector<uint16_t>& indices);
+void MeshTriangulate(Mesh* mesh, const Vector3* positions, const uint16_t* indices, size_t index_count);
+void MeshTriangulate(Mesh* mesh, const Vector3* positions, const uint32_t* indices, size_t index_count);
+void MeshBuildSoA(Mesh* mesh);
+
+// Welds the corners into the indexed copy, releasing soa_x. MeshTriangulate replaces it with soa_x again
+void MeshBuildIndexed(Mesh* mesh);
+
+// Sets the indexed copy from vertices that are already welded and numbered (ie by MeshCook), as MeshBuildIndexed would have built it
+void MeshSetIndexed(Mesh* mesh, const Vector3* vertices, size_t vertex_count, const uint16_t* indices, size_t index_count);
+void MeshSetIndexed(Mesh* mesh, const Vector3* vertices, size_t vertex_count, const uint32_t* indices, size_t index_count);
+
+// Rebuilds the indexed copy in the compact layout, with normal_bits (8 or 16) per normal component, building it first if there isn't one.
+// positions, normals and vertex_x are released, so meshlets and the BVH must be built before (meshlets need the float normals).
+// MeshBuildIndexed goes back to full precision, from the dequantized vertices and decoded normals.
+// LODs are meshes of their own and are quantized separately
+void MeshQuantize(Mesh* mesh, int normal_bits = 16);
+
+// Octahedral normals -- the unit sphere folded onto the square [-1, 1]^2. Decoded normals point the right way but aren't normalized
+inline Vector3 MeshDecodeNormal(float u, float v)
+{
+	Vector3 n = { u, v, 1.0f - fabsf(u) - fabsf(v) };
+	float fold = fmaxf(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -fold : fold;
+	n.y += n.y >= 0.0f ? -fold : fold;
+	return n;
+}
+
+inline Vector3 MeshDecodeNormal8(uint16_t n)
+{
+	return MeshDecodeNormal((int8_t)(n & 0xFF) / 127.0f, (int8_t)(n >> 8) / 127.0f);
+}
+
+inline Vector3 MeshDecodeNormal16(uint32_t n)
+{
+	return MeshDecodeNormal((int16_t)(n & 0xFFFF) / 32767.0f, (int16_t)(n >> 16) / 32767.0f);
+}
+void MeshComputeBounds(Mesh* mesh);
+
+// Corners at the same position welded into shared vertices. indices gets 3 per face
+void MeshWeld(const Mesh& mesh, std::vector<Vector3>* positions, std::vector<uint32_t>* indices);
+
+// Reorders the faces so neighbouring faces with similar normals share a meshlet, then fills mesh->meshlets (see Meshlet.cpp).
+// Meshes without positions only have their indices reordered, the vertices stay where they are. Needs normals, so not after MeshQuantize.
+// Without cluster the faces are taken as they are, for an order already clustered and then refined within each meshlet (ie by MeshCook)
+void MeshBuildMeshlets(Mesh* mesh, bool cluster = true);
+
+// Builds mesh->bvh_nodes with the surface area heuristic (see MeshBvh.cpp). Must be rebuilt if the faces change or are reordered
+void MeshBuildBvh(Mesh* mesh);
+
+// Whether mesh's BVH can be traversed safely: every index in range and no deeper than the traversal stack. For BVHs read from files
+bool MeshValidateBvh(const Mesh& mesh);
+
+// Ray (or segment, when max_t is 1 and direction is the segment's end minus its start) against the mesh's faces in local space.
+// Faces are hit from either side. Uses the BVH if there is one, otherwise tests every face.
+// MeshRaycast finds the closest hit, MeshRaycastAny stops at the first one (ie for line of sight)
+bool MeshRaycast(const Mesh& mesh, Vector3 origin, Vector3 direction, float max_t, MeshHit* hit);
+bool MeshRaycastAny(const Mesh& mesh, Vector3 origin, Vector3 direction, float max_t);
+
+// Builds mesh->lods by quadric-error edge collapse (see MeshLod.cpp). Meshes with more than 65536 unique positions get no LODs
+void MeshBuildLods(Mesh* mesh);
 void MeshUnload(Mesh* mesh);
@@ -0,0 +1,318 @@
+#include "Mesh.h"
+#include <algorithm>
+
+static constexpr int BVH_BIN_COUNT = 16;			// Candidate split planes per axis
+static constexpr uint32_t BVH_MAX_LEAF_FACES = 8;	// Larger leaves are split even if the heuristic says not to
+static constexpr int BVH_MAX_DEPTH = 64;			// Also the traversal stack size
+static constexpr float BVH_TRAVERSAL_COST = 1.0f;	// Cost of visiting a node, relative to testing a face
+
+struct BvhBuilder
+{
+	std::vector<Vector3> centroids;
+	std::vector<Vector3> face_min;
+	std::vector<Vector3> face_max;
+	std::vector<BvhNode>* nodes;
+	std::vector<uint32_t>* faces;
+};
+
+static float SurfaceArea(Vector3 lo, Vector3 hi)
+{
+	Vector3 d = hi - lo;
+	return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+// Binned SAH (Wald 2007) -- faces are binned by centroid along each axis and the split between bins with the lowest
+// expected cost of a ray test is taken, or the faces become a leaf if that's cheaper
+static void BuildNode(BvhBuilder& b, uint32_t node, uint32_t begin, uint32_t end, int depth)
+{
+	uint32_t* faces = b.faces->data();
+	Vector3 lo = { INFINITY, INFINITY, INFINITY };
+	Vector3 hi = { -INFINITY, -INFINITY, -INFINITY };
+	Vector3 centroid_lo = lo;
+	Vector3 centroid_hi = hi;
+	for (uint32_t i = begin; i < end; i++)
+	{
+		uint32_t f = faces[i];
+		lo = Vector3Min(lo, b.face_min[f]);
+		hi = Vector3Max(hi, b.face_max[f]);
+		centroid_lo = Vector3Min(centroid_lo, b.centroids[f]);
+		centroid_hi = Vector3Max(centroid_hi, b.centroids[f]);
+	}
+
+	uint32_t count = end - begin;
+	BvhNode& leaf = (*b.nodes)[node];
+	leaf.bounds_min = lo;
+	leaf.bounds_max = hi;
+	leaf.first = begin;
+	leaf.count = count;
+	if (count <= 1 || depth + 1 >= BVH_MAX_DEPTH) return;
+
+	float best_cost = INFINITY;
+	int best_axis = -1;
+	int best_split = 0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float axis_lo = (&centroid_lo.x)[axis];
+		float extent = (&centroid_hi.x)[axis] - axis_lo;
+		if (!(extent > 0.0f)) continue;
+
+		uint32_t bin_counts[BVH_BIN_COUNT] = {};
+		Vector3 bin_lo[BVH_BIN_COUNT];
+		Vector3 bin_hi[BVH_BIN_COUNT];
+		std::fill(bin_lo, bin_lo + BVH_BIN_COUNT, Vector3{ INFINITY, INFINITY, INFINITY });
+		std::fill(bin_hi, bin_hi + BVH_BIN_COUNT, Vector3{ -INFINITY, -INFINITY, -INFINITY });
+		float scale = BVH_BIN_COUNT / extent;
+		for (uint32_t i = begin; i < end; i++)
+		{
+			uint32_t f = faces[i];
+			int bin = std::min((int)(((&b.centroids[f].x)[axis] - axis_lo) * scale), BVH_BIN_COUNT - 1);
+			bin_counts[bin]++;
+			bin_lo[bin] = Vector3Min(bin_lo[bin], b.face_min[f]);
+			bin_hi[bin] = Vector3Max(bin_hi[bin], b.face_max[f]);
+		}
+
+		// Sweep from the right to get the cost of everything after each split, then from the left to add everything before it.
+		// Splitting after bin i puts bins [0, i] on the left
+		float right_costs[BVH_BIN_COUNT];
+		Vector3 right_lo = { INFINITY, INFINITY, INFINITY };
+		Vector3 right_hi = { -INFINITY, -INFINITY, -INFINITY };
+		uint32_t right_count = 0;
+		for (int i = BVH_BIN_COUNT - 1; i > 0; i--)
+		{
+			right_lo = Vector3Min(right_lo, bin_lo[i]);
+			right_hi = Vector3Max(right_hi, bin_hi[i]);
+			right_count += bin_counts[i];
+			right_costs[i - 1] = right_count > 0 ? SurfaceArea(right_lo, right_hi) * right_count : INFINITY;
+		}
+
+		Vector3 left_lo = { INFINITY, INFINITY, INFINITY };
+		Vector3 left_hi = { -INFINITY, -INFINITY, -INFINITY };
+		uint32_t left_count = 0;
+		for (int i = 0; i < BVH_BIN_COUNT - 1; i++)
+		{
+			left_lo = Vector3Min(left_lo, bin_lo[i]);
+			left_hi = Vector3Max(left_hi, bin_hi[i]);
+			left_count += bin_counts[i];
+			if (left_count == 0 || left_count == count) continue;
+
+			float cost = SurfaceArea(left_lo, left_hi) * left_count + right_costs[i];
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				best_axis = axis;
+				best_split = i;
+			}
+		}
+	}
+
+	// Costs are relative to the node's area, the chance a ray hitting the node also hits a child
+	float area = SurfaceArea(lo, hi);
+	float leaf_cost = (float)count * area;
+	float split_cost = BVH_TRAVERSAL_COST * area + best_cost;
+	if (best_axis < 0 || (split_cost >= leaf_cost && count <= BVH_MAX_LEAF_FACES)) return;
+
+	float axis_lo = (&centroid_lo.x)[best_axis];
+	float scale = BVH_BIN_COUNT / ((&centroid_hi.x)[best_axis] - axis_lo);
+	// Stable, so the face order (and a cooked file's BVH) doesn't depend on the standard library
+	uint32_t* middle = std::stable_partition(faces + begin, faces + end, [&](uint32_t f)
+	{
+		int bin = std::min((int)(((&b.centroids[f].x)[best_axis] - axis_lo) * scale), BVH_BIN_COUNT - 1);
+		return bin <= best_split;
+	});
+	uint32_t mid = (uint32_t)(middle - faces);
+
+	// Children are added right before they're built, so the first child is always node + 1
+	(*b.nodes)[node].count = 0;
+	uint32_t left = (uint32_t)b.nodes->size();
+	b.nodes->emplace_back();
+	BuildNode(b, left, begin, mid, depth + 1);
+
+	uint32_t right = (uint32_t)b.nodes->size();
+	b.nodes->emplace_back();
+	(*b.nodes)[node].first = right;
+	BuildNode(b, right, mid, end, depth + 1);
+}
+
+void MeshBuildBvh(Mesh* mesh)
+{
+	mesh->bvh_nodes.clear();
+	mesh->bvh_faces.clear();
+	if (mesh->face_count == 0) return;
+
+	BvhBuilder b;
+	b.centroids.resize(mesh->face_count);
+	b.face_min.resize(mesh->face_count);
+	b.face_max.resize(mesh->face_count);
+	for (size_t f = 0; f < mesh->face_count; f++)
+	{
+		Vector3 p[3] = { MeshCorner(*mesh, f * 3 + 0), MeshCorner(*mesh, f * 3 + 1), MeshCorner(*mesh, f * 3 + 2) };
+		b.face_min[f] = Vector3Min(p[0], Vector3Min(p[1], p[2]));
+		b.face_max[f] = Vector3Max(p[0], Vector3Max(p[1], p[2]));
+		b.centroids[f] = (p[0] + p[1] + p[2]) / 3.0f;
+	}
+
+	mesh->bvh_faces.resize(mesh->face_count);
+	for (size_t f = 0; f < mesh->face_count; f++)
+		mesh->bvh_faces[f] = (uint32_t)f;
+
+	mesh->bvh_nodes.reserve(mesh->face_count * 2);
+	mesh->bvh_nodes.emplace_back();
+	b.nodes = &mesh->bvh_nodes;
+	b.faces = &mesh->bvh_faces;
+	BuildNode(b, 0, 0, (uint32_t)mesh->face_count, 0);
+	mesh->bvh_nodes.shrink_to_fit();
+}
+
+bool MeshValidateBvh(const Mesh& mesh)
+{
+	if (mesh.bvh_nodes.empty()) return mesh.bvh_faces.empty();
+	for (uint32_t f : mesh.bvh_faces)
+	{
+		if (f >= mesh.face_count) return false;
+	}
+
+	// Children always come after their parent, so one pass in order sees every parent's depth before its children's
+	size_t node_count = mesh.bvh_nodes.size();
+	std::vector<int> depths(node_count, 0);
+	for (size_t i = 0; i < node_count; i++)
+	{
+		const BvhNode& node = mesh.bvh_nodes[i];
+		if (depths[i] >= BVH_MAX_DEPTH) return false;
+		if (node.count > 0)
+		{
+			if ((uint64_t)node.first + node.count > mesh.bvh_faces.size()) return false;
+			continue;
+		}
+		if (i + 1 >= node_count || node.first <= i + 1 || node.first >= node_count) return false;
+		depths[i + 1] = std::max(depths[i + 1], depths[i] + 1);
+		depths[node.first] = std::max(depths[node.first], depths[i] + 1);
+	}
+	return true;
+}
+
+// Möller-Trumbore, two-sided
+static bool IntersectFace(const Vector3* p, Vector3 origin, Vector3 direction, float* t)
+{
+	Vector3 e1 = p[1] - p[0];
+	Vector3 e2 = p[2] - p[0];
+	Vector3 pv = Vector3CrossProduct(direction, e2);
+	float det = Vector3DotProduct(e1, pv);
+	if (!(det != 0.0f)) return false;
+
+	float inv_det = 1.0f / det;
+	Vector3 tv = origin - p[0];
+	float u = Vector3DotProduct(tv, pv) * inv_det;
+	if (u < 0.0f || u > 1.0f) return false;
+
+	Vector3 qv = Vector3CrossProduct(tv, e1);
+	float v = Vector3DotProduct(direction, qv) * inv_det;
+	if (v < 0.0f || u + v > 1.0f) return false;
+
+	*t = Vector3DotProduct(e2, qv) * inv_det;
+	return *t >= 0.0f;
+}
+
+// Distance along the ray to where it enters the box, or INFINITY if it misses or enters beyond max_t
+static float IntersectBox(const BvhNode& node, Vector3 origin, Vector3 inv_direction, float max_t)
+{
+	Vector3 t0 = (node.bounds_min - origin) * inv_direction;
+	Vector3 t1 = (node.bounds_max - origin) * inv_direction;
+	float t_enter = fmaxf(fmaxf(fminf(t0.x, t1.x), fminf(t0.y, t1.y)), fmaxf(fminf(t0.z, t1.z), 0.0f));
+	float t_exit = fminf(fminf(fmaxf(t0.x, t1.x), fmaxf(t0.y, t1.y)), fminf(fmaxf(t0.z, t1.z), max_t));
+	return t_enter <= t_exit ? t_enter : INFINITY;
+}
+
+// Closest hit (or any hit, which can stop early) before max_t. Children are visited nearest first, and skipped once
+// they start beyond the closest hit so far
+template<bool any>
+static bool Raycast(const Mesh& mesh, Vector3 origin, Vector3 direction, float max_t, uint32_t* face, float* t)
+{
+	float best_t = max_t;
+	uint32_t best_face = ~0u;
+	auto test = [&](uint32_t f)
+	{
+		float face_t;
+		Vector3 p[3] = { MeshCorner(mesh, f * 3 + 0), MeshCorner(mesh, f * 3 + 1), MeshCorner(mesh, f * 3 + 2) };
+		if (IntersectFace(p, origin, direction, &face_t) && face_t <= best_t)
+		{
+			best_t = face_t;
+			best_face = f;
+		}
+	};
+
+	if (mesh.bvh_nodes.empty())
+	{
+		for (uint32_t f = 0; f < mesh.face_count && !(any && best_face != ~0u); f++)
+			test(f);
+	}
+	else
+	{
+		const BvhNode* nodes = mesh.bvh_nodes.data();
+		Vector3 inv_direction = { 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z };
+		uint32_t stack[BVH_MAX_DEPTH];
+		int stack_size = 0;
+		uint32_t node = 0;
+		bool visit = IntersectBox(nodes[0], origin, inv_direction, best_t) != INFINITY;
+		while (visit)
+		{
+			const BvhNode& n = nodes[node];
+			if (n.count > 0)
+			{
+				for (uint32_t i = n.first; i < n.first + n.count; i++)
+					test(mesh.bvh_faces[i]);
+				if (any && best_face != ~0u) break;
+			}
+			else
+			{
+				uint32_t near_child = node + 1;
+				uint32_t far_child = n.first;
+				float t_near = IntersectBox(nodes[near_child], origin, inv_direction, best_t);
+				float t_far = IntersectBox(nodes[far_child], origin, inv_direction, best_t);
+				if (t_far < t_near)
+				{
+					std::swap(near_child, far_child);
+					std::swap(t_near, t_far);
+				}
+
+				if (t_near != INFINITY)
+				{
+					if (t_far != INFINITY)
+						stack[stack_size++] = far_child;
+					node = near_child;
+					continue;
+				}
+			}
+
+			// Nodes on the stack may start beyond a hit found since they were pushed
+			visit = false;
+			while (stack_size > 0 && !visit)
+			{
+				node = stack[--stack_size];
+				visit = IntersectBox(nodes[node], origin, inv_direction, best_t) != INFINITY;
+			}
+		}
+	}
+
+	*face = best_face;
+	*t = best_t;
+	return best_face != ~0u;
+}
+
+bool MeshRaycast(const Mesh& mesh, Vector3 origin, Vector3 direction, float max_t, MeshHit* hit)
+{
+	uint32_t face;
+	float t;
+	if (!Raycast<false>(mesh, origin, direction, max_t, &face, &t)) return false;
+
+	hit->t = t;
+	hit->face = face;
+	hit->position = origin + direction * t;
+	return true;
+}
+
+bool MeshRaycastAny(const Mesh& mesh, Vector3 origin, Vector3 direction, float max_t)
+{
+	uint32_t face;
+	float t;
+	return Raycast<true>(mesh, origin, direction, max_t, &face, &t);
+}
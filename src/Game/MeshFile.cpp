@@ -0,0 +1,343 @@
+#include "Mesh.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#if !BUILD_PLATFORM_WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Version 1 .vbo_nxt files are two 64-bit counts, then the positions, then 3 16-bit indices per face. Nothing else is stored.
+// Version 2 files are written by MeshCook with everything MeshImport would build already built: MeshFileHeader locates each array (section)
+// in the file, and one MeshFileLevel per level (the mesh, then its LODs) holds its indexed copy, face normals, meshlets and bounds.
+// The BVH is stored once, for the mesh itself, so importing is a validated copy. v1 files only start with the magic if the low 32 bits of
+// their position count are 843,006,550, more positions than 16-bit indices can use
+static constexpr uint32_t MESH_FILE_MAGIC = 0x324F4256;	// "VBO2"
+static constexpr uint32_t MESH_FILE_VERSION = 2;
+static constexpr size_t MESH_FILE_ALIGNMENT = 64;		// Section offsets are multiples of this, so ImportLevel can read each section through a pointer to its element type
+static constexpr size_t MESH_FILE_MAX_LEVELS = MESH_LOD_MAX_LEVELS + 1;
+
+enum MeshFileSectionType
+{
+	MESH_FILE_LEVELS,		// MeshFileLevel per level
+	MESH_FILE_BVH_NODES,	// BvhNode per node
+	MESH_FILE_BVH_FACES,	// uint32_t per face
+	MESH_FILE_SECTION_COUNT
+};
+
+enum MeshFileLevelSectionType
+{
+	MESH_FILE_POSITIONS,	// Vector3 per vertex
+	MESH_FILE_INDICES,		// index_size bytes per index, 3 per face
+	MESH_FILE_NORMALS,		// Vector3 per face
+	MESH_FILE_MESHLETS,		// Meshlet per meshlet
+	MESH_FILE_LEVEL_SECTION_COUNT
+};
+
+struct MeshFileSection
+{
+	uint64_t offset;	// From the start of the file
+	uint64_t size;		// Bytes
+};
+
+struct MeshFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;	// sizeof(MeshFileHeader), so later versions can grow it
+	uint32_t level_count;	// 1 for the mesh, plus 1 per LOD
+	uint64_t file_size;
+	uint64_t bvh_node_count;
+	uint64_t bvh_face_count;
+	MeshFileSection sections[MESH_FILE_SECTION_COUNT];
+	uint32_t checksum;		// MeshFileChecksum of every byte after the header
+	uint32_t reserved;
+};
+static_assert(sizeof(MeshFileHeader) == 96, "MeshFileHeader is written as-is and must have no padding");
+
+struct MeshFileLevel
+{
+	uint64_t position_count;	// Vertices of the indexed copy
+	uint64_t index_count;
+	uint64_t meshlet_count;		// 0, or one per MESH_MESHLET_FACES faces
+	uint32_t index_size;		// 2 or 4
+	float lod_error;
+	Vector3 bounds_min;
+	Vector3 bounds_max;
+	Vector3 bounds_center;
+	float bounds_radius;
+	MeshFileSection sections[MESH_FILE_LEVEL_SECTION_COUNT];
+};
+static_assert(sizeof(MeshFileLevel) == 136, "MeshFileLevel is written as-is and must have no padding");
+
+// 32-bit FNV-1a
+static uint32_t MeshFileChecksum(const uint8_t* data, size_t size)
+{
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ data[i]) * 16777619u;
+	return hash;
+}
+
+template<typename Index>
+static bool IndicesInRange(const Index* indices, size_t index_count, size_t position_count)
+{
+	for (size_t i = 0; i < index_count; i++)
+	{
+		if (indices[i] >= position_count) return false;
+	}
+	return true;
+}
+
+// Sections must be aligned, lie between the header and the end of the file, and be exactly the size their counts imply
+static bool SectionValid(const MeshFileSection& section, uint64_t count, uint64_t stride, size_t size)
+{
+	if (section.offset % MESH_FILE_ALIGNMENT != 0 || section.offset < sizeof(MeshFileHeader) || section.offset > size) return false;
+	return count <= (size - section.offset) / stride && section.size == count * stride;
+}
+
+static bool ImportV1(Mesh* mesh, const uint8_t* data, size_t size)
+{
+	uint64_t counts[2];
+	if (size < sizeof(counts)) return false;
+	memcpy(counts, data, sizeof(counts));
+
+	size_t left = size - sizeof(counts);
+	uint64_t position_count = counts[0];
+	uint64_t index_count = counts[1];
+	if (position_count > left / sizeof(Vector3)) return false;
+	left -= position_count * sizeof(Vector3);
+	if (index_count > left / sizeof(uint16_t) || index_count % 3 != 0) return false;
+
+	const Vector3* positions = (const Vector3*)(data + sizeof(counts));
+	const uint16_t* indices = (const uint16_t*)(data + sizeof(counts) + position_count * sizeof(Vector3));
+	if (!IndicesInRange(indices, index_count, position_count)) return false;
+
+	MeshTriangulate(mesh, positions, indices, index_count);
+	return true;
+}
+
+static bool LevelValid(const MeshFileLevel& level, const uint8_t* data, size_t size)
+{
+	if ((level.index_size != 2 && level.index_size != 4) || level.index_count % 3 != 0) return false;
+	uint64_t face_count = level.index_count / 3;
+	if (level.meshlet_count != 0 && level.meshlet_count != (face_count + MESH_MESHLET_FACES - 1) / MESH_MESHLET_FACES) return false;
+
+	uint64_t counts[MESH_FILE_LEVEL_SECTION_COUNT] = { level.position_count, level.index_count, face_count, level.meshlet_count };
+	uint64_t strides[MESH_FILE_LEVEL_SECTION_COUNT] = { sizeof(Vector3), level.index_size, sizeof(Vector3), sizeof(Meshlet) };
+	for (int i = 0; i < MESH_FILE_LEVEL_SECTION_COUNT; i++)
+	{
+		if (!SectionValid(level.sections[i], counts[i], strides[i], size)) return false;
+	}
+
+	const uint8_t* indices = data + level.sections[MESH_FILE_INDICES].offset;
+	return level.index_size == 2 ?
+		IndicesInRange((const uint16_t*)indices, level.index_count, level.position_count) :
+		IndicesInRange((const uint32_t*)indices, level.index_count, level.position_count);
+}
+
+// Everything is taken as stored. The faces stay indexed, positions aren't expanded from them (see MeshExpandPositions)
+static void ImportLevel(Mesh* mesh, const MeshFileLevel& level, const uint8_t* data)
+{
+	const Vector3* positions = (const Vector3*)(data + level.sections[MESH_FILE_POSITIONS].offset);
+	const uint8_t* indices = data + level.sections[MESH_FILE_INDICES].offset;
+	const Vector3* normals = (const Vector3*)(data + level.sections[MESH_FILE_NORMALS].offset);
+	const Meshlet* meshlets = (const Meshlet*)(data + level.sections[MESH_FILE_MESHLETS].offset);
+
+	mesh->face_count = level.index_count / 3;
+	if (level.index_size == 2)
+		MeshSetIndexed(mesh, positions, level.position_count, (const uint16_t*)indices, level.index_count);
+	else
+		MeshSetIndexed(mesh, positions, level.position_count, (const uint32_t*)indices, level.index_count);
+	mesh->normals.assign(normals, normals + mesh->face_count);
+	mesh->meshlets.assign(meshlets, meshlets + level.meshlet_count);
+	mesh->bounds_min = level.bounds_min;
+	mesh->bounds_max = level.bounds_max;
+	mesh->bounds_center = level.bounds_center;
+	mesh->bounds_radius = level.bounds_radius;
+	mesh->lod_error = level.lod_error;
+}
+
+static bool ImportV2(Mesh* mesh, const uint8_t* data, size_t size)
+{
+	MeshFileHeader header;
+	if (size < sizeof(header)) return false;
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != MESH_FILE_MAGIC || header.version != MESH_FILE_VERSION || header.header_size != sizeof(header)) return false;
+	if (header.file_size != size || header.level_count == 0 || header.level_count > MESH_FILE_MAX_LEVELS) return false;
+
+	uint64_t counts[MESH_FILE_SECTION_COUNT] = { header.level_count, header.bvh_node_count, header.bvh_face_count };
+	uint64_t strides[MESH_FILE_SECTION_COUNT] = { sizeof(MeshFileLevel), sizeof(BvhNode), sizeof(uint32_t) };
+	for (int i = 0; i < MESH_FILE_SECTION_COUNT; i++)
+	{
+		if (!SectionValid(header.sections[i], counts[i], strides[i], size)) return false;
+	}
+
+	if (MeshFileChecksum(data + sizeof(header), size - sizeof(header)) != header.checksum) return false;
+
+	MeshFileLevel levels[MESH_FILE_MAX_LEVELS];
+	memcpy(levels, data + header.sections[MESH_FILE_LEVELS].offset, header.level_count * sizeof(MeshFileLevel));
+	for (uint32_t i = 0; i < header.level_count; i++)
+	{
+		if (!LevelValid(levels[i], data, size)) return false;
+	}
+
+	// Loaded aside, so mesh is left untouched if the BVH turns out to be invalid
+	Mesh loaded;
+	ImportLevel(&loaded, levels[0], data);
+	loaded.lods.resize(header.level_count - 1);
+	for (uint32_t i = 1; i < header.level_count; i++)
+		ImportLevel(&loaded.lods[i - 1], levels[i], data);
+
+	const BvhNode* bvh_nodes = (const BvhNode*)(data + header.sections[MESH_FILE_BVH_NODES].offset);
+	const uint32_t* bvh_faces = (const uint32_t*)(data + header.sections[MESH_FILE_BVH_FACES].offset);
+	loaded.bvh_nodes.assign(bvh_nodes, bvh_nodes + header.bvh_node_count);
+	loaded.bvh_faces.assign(bvh_faces, bvh_faces + header.bvh_face_count);
+	if (!MeshValidateBvh(loaded)) return false;
+
+	*mesh = std::move(loaded);
+	return true;
+}
+
+bool MeshImport(Mesh* mesh, const char* filename)
+{
+#if BUILD_PLATFORM_WINDOWS
+	std::ifstream in(filename, std::ios::binary | std::ios::ate);
+	if (!in) return false;
+	std::vector<uint8_t> file((size_t)in.tellg());
+	in.seekg(0);
+	in.read((char*)file.data(), file.size());
+	if (!in) return false;
+	const uint8_t* data = file.data();
+	size_t size = file.size();
+#else
+	// Mapped rather than read into a buffer, so each section is copied once, from the mapping into the mesh's own arrays
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	size_t size = fstat(fd, &st) == 0 ? (size_t)st.st_size : 0;
+	void* mapping = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (mapping == MAP_FAILED) return false;
+	madvise(mapping, size, MADV_WILLNEED);
+	const uint8_t* data = (const uint8_t*)mapping;
+#endif
+
+	uint32_t magic = 0;
+	if (size >= sizeof(magic))
+		memcpy(&magic, data, sizeof(magic));
+	bool cooked = magic == MESH_FILE_MAGIC;
+	bool valid = cooked ? ImportV2(mesh, data, size) : ImportV1(mesh, data, size);
+#if !BUILD_PLATFORM_WINDOWS
+	munmap(mapping, size);
+#endif
+	if (!valid) return false;
+	if (cooked) return true;
+
+	// v1 files are only the faces, so everything a v2 file stores is built here. Cook them with MeshCook to skip this.
+	// positions were only needed by the builders, so like a v2 file the mesh ends up with just the indexed copy
+	MeshBuildLods(mesh);
+	MeshBuildMeshlets(mesh);
+	MeshBuildIndexed(mesh);
+	for (Mesh& lod : mesh->lods)
+	{
+		MeshBuildMeshlets(&lod);
+		MeshBuildIndexed(&lod);
+		std::vector<Vector3>().swap(lod.positions);
+	}
+	MeshBuildBvh(mesh);
+	std::vector<Vector3>().swap(mesh->positions);
+	return true;
+}
+
+// Where the next section of size bytes goes, after the one ending at *offset
+static MeshFileSection PlaceSection(size_t* offset, size_t size)
+{
+	*offset = (*offset + MESH_FILE_ALIGNMENT - 1) / MESH_FILE_ALIGNMENT * MESH_FILE_ALIGNMENT;
+	MeshFileSection section = { *offset, size };
+	*offset += size;
+	return section;
+}
+
+bool MeshExport(const char* filename, const Mesh& mesh)
+{
+	size_t level_count = mesh.lods.size() + 1;
+	if (level_count > MESH_FILE_MAX_LEVELS) return false;
+	const Mesh* levels[MESH_FILE_MAX_LEVELS];
+	levels[0] = &mesh;
+	for (size_t i = 1; i < level_count; i++)
+		levels[i] = &mesh.lods[i - 1];
+
+	MeshFileHeader header = {};
+	header.magic = MESH_FILE_MAGIC;
+	header.version = MESH_FILE_VERSION;
+	header.header_size = sizeof(header);
+	header.level_count = (uint32_t)level_count;
+	header.bvh_node_count = mesh.bvh_nodes.size();
+	header.bvh_face_count = mesh.bvh_faces.size();
+
+	size_t offset = sizeof(header);
+	header.sections[MESH_FILE_LEVELS] = PlaceSection(&offset, level_count * sizeof(MeshFileLevel));
+	header.sections[MESH_FILE_BVH_NODES] = PlaceSection(&offset, mesh.bvh_nodes.size() * sizeof(BvhNode));
+	header.sections[MESH_FILE_BVH_FACES] = PlaceSection(&offset, mesh.bvh_faces.size() * sizeof(uint32_t));
+
+	MeshFileLevel file_levels[MESH_FILE_MAX_LEVELS] = {};
+	for (size_t i = 0; i < level_count; i++)
+	{
+		// The indexed copy is what's written, at full precision
+		const Mesh& level = *levels[i];
+		if (level.vertex_count == 0 || level.vertex_x.empty() || level.normals.size() != level.face_count) return false;
+		if (!level.meshlets.empty() && level.meshlets.size() != (level.face_count + MESH_MESHLET_FACES - 1) / MESH_MESHLET_FACES) return false;
+
+		MeshFileLevel& file_level = file_levels[i];
+		file_level.position_count = level.vertex_count;
+		file_level.index_count = level.face_count * 3;
+		file_level.meshlet_count = level.meshlets.size();
+		file_level.index_size = level.indices_16.empty() ? 4 : 2;
+		file_level.lod_error = level.lod_error;
+		file_level.bounds_min = level.bounds_min;
+		file_level.bounds_max = level.bounds_max;
+		file_level.bounds_center = level.bounds_center;
+		file_level.bounds_radius = level.bounds_radius;
+
+		size_t sizes[MESH_FILE_LEVEL_SECTION_COUNT] = {
+			level.vertex_count * sizeof(Vector3), file_level.index_count * file_level.index_size,
+			level.face_count * sizeof(Vector3), level.meshlets.size() * sizeof(Meshlet) };
+		for (int j = 0; j < MESH_FILE_LEVEL_SECTION_COUNT; j++)
+			file_level.sections[j] = PlaceSection(&offset, sizes[j]);
+	}
+	header.file_size = offset;
+
+	// Built in memory so the checksum can go in the header, padding is zeroed
+	std::vector<uint8_t> file(offset, 0);
+	for (size_t i = 0; i < level_count; i++)
+	{
+		const Mesh& level = *levels[i];
+		const MeshFileLevel& file_level = file_levels[i];
+		Vector3* positions = (Vector3*)(file.data() + file_level.sections[MESH_FILE_POSITIONS].offset);
+		for (size_t v = 0; v < level.vertex_count; v++)
+			positions[v] = { level.vertex_x[v], level.vertex_y[v], level.vertex_z[v] };
+
+		const MeshFileSection& indices = file_level.sections[MESH_FILE_INDICES];
+		if (file_level.index_size == 2)
+			memcpy(file.data() + indices.offset, level.indices_16.data(), indices.size);
+		else
+			memcpy(file.data() + indices.offset, level.indices_32.data(), indices.size);
+		memcpy(file.data() + file_level.sections[MESH_FILE_NORMALS].offset, level.normals.data(), file_level.sections[MESH_FILE_NORMALS].size);
+		memcpy(file.data() + file_level.sections[MESH_FILE_MESHLETS].offset, level.meshlets.data(), file_level.sections[MESH_FILE_MESHLETS].size);
+	}
+	memcpy(file.data() + header.sections[MESH_FILE_LEVELS].offset, file_levels, header.sections[MESH_FILE_LEVELS].size);
+	memcpy(file.data() + header.sections[MESH_FILE_BVH_NODES].offset, mesh.bvh_nodes.data(), header.sections[MESH_FILE_BVH_NODES].size);
+	memcpy(file.data() + header.sections[MESH_FILE_BVH_FACES].offset, mesh.bvh_faces.data(), header.sections[MESH_FILE_BVH_FACES].size);
+	header.checksum = MeshFileChecksum(file.data() + sizeof(header), file.size() - sizeof(header));
+	memcpy(file.data(), &header, sizeof(header));
+
+	FILE* out = fopen(filename, "wb");
+	if (out == nullptr) return false;
+	fwrite(file.data(), 1, file.size(), out);
+	bool success = ferror(out) == 0;
+	fclose(out);
+	return success;
+}
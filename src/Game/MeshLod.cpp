@@ -0,0 +1,304 @@
+#include "Mesh.h"
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
+
+// Symmetric 4x4 error quadric (Garland & Heckbert), storing only its 10 unique coefficients.
+// The sum of a vertex's quadrics gives the squared distance from a point to every plane the vertex started on
+struct Quadric
+{
+	double a[10] = {};
+
+	void AddPlane(Vector3 n, float d, double weight)
+	{
+		double nx = n.x, ny = n.y, nz = n.z, nd = d;
+		double plane[10] = { nx * nx, nx * ny, nx * nz, nx * nd, ny * ny, ny * nz, ny * nd, nz * nz, nz * nd, nd * nd };
+		for (int i = 0; i < 10; i++)
+			a[i] += plane[i] * weight;
+	}
+
+	void Add(const Quadric& q)
+	{
+		for (int i = 0; i < 10; i++)
+			a[i] += q.a[i];
+	}
+
+	double Error(Vector3 p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double e =
+			a[0] * x * x + 2.0 * a[1] * x * y + 2.0 * a[2] * x * z + 2.0 * a[3] * x +
+			a[4] * y * y + 2.0 * a[5] * y * z + 2.0 * a[6] * y +
+			a[7] * z * z + 2.0 * a[8] * z + a[9];
+		return std::max(e, 0.0);
+	}
+};
+
+struct Collapse
+{
+	double cost;
+	uint32_t from, to;	// from is merged into to
+	uint32_t from_version, to_version;
+	Vector3 position;
+
+	// std::priority_queue is a max-heap, so the cheapest collapse comes first. Equal costs are common (flat areas, and both directions
+	// of an edge), so ties go by vertex number, or the order and every LOD would depend on the standard library's heap
+	bool operator<(const Collapse& other) const
+	{
+		if (cost != other.cost) return cost > other.cost;
+		if (from != other.from) return from > other.from;
+		return to > other.to;
+	}
+};
+
+struct Simplifier
+{
+	std::vector<Vector3> positions;
+	std::vector<Quadric> quadrics;
+	std::vector<uint32_t> versions;	// Bumped whenever a vertex moves, invalidating queued collapses that involve it
+	std::vector<bool> removed;
+	std::vector<std::vector<uint32_t>> vertex_faces;	// May list faces that no longer use the vertex, always check
+	std::vector<uint32_t> faces;	// 3 indices per face
+	std::vector<bool> faces_removed;
+	size_t face_count = 0;
+	std::priority_queue<Collapse> queue;
+};
+
+static constexpr float LOD_BOUNDARY_WEIGHT = 10.0f;	// Keeps open edges (ie a hole in the mesh) from shrinking
+static constexpr float LOD_MIN_FLIP_COS = 0.2f;		// Collapses can't turn a face more than ~80 degrees
+
+static Vector3 FaceCross(Vector3 a, Vector3 b, Vector3 c)
+{
+	return Vector3CrossProduct(b - a, c - a);
+}
+
+static bool FaceUses(const Simplifier& s, uint32_t f, uint32_t v)
+{
+	return s.faces[f * 3 + 0] == v || s.faces[f * 3 + 1] == v || s.faces[f * 3 + 2] == v;
+}
+
+static void QueueCollapse(Simplifier& s, uint32_t from, uint32_t to)
+{
+	Quadric q = s.quadrics[from];
+	q.Add(s.quadrics[to]);
+
+	// Solving for the optimal position can be unstable on flat areas, so the best of the endpoints and midpoint is used instead
+	Vector3 candidates[3] = { s.positions[to], s.positions[from], (s.positions[to] + s.positions[from]) * 0.5f };
+	Collapse c;
+	c.cost = INFINITY;
+	for (Vector3 p : candidates)
+	{
+		double e = q.Error(p);
+		if (e < c.cost)
+		{
+			c.cost = e;
+			c.position = p;
+		}
+	}
+	c.from = from;
+	c.to = to;
+	c.from_version = s.versions[from];
+	c.to_version = s.versions[to];
+	s.queue.push(c);
+}
+
+// Vertices sharing a face with v
+static void GatherNeighbours(const Simplifier& s, uint32_t v, std::vector<uint32_t>* neighbours)
+{
+	neighbours->clear();
+	for (uint32_t f : s.vertex_faces[v])
+	{
+		if (s.faces_removed[f] || !FaceUses(s, f, v)) continue;
+		for (int i = 0; i < 3; i++)
+		{
+			uint32_t n = s.faces[f * 3 + i];
+			if (n != v)
+				neighbours->push_back(n);
+		}
+	}
+	std::sort(neighbours->begin(), neighbours->end());
+	neighbours->erase(std::unique(neighbours->begin(), neighbours->end()), neighbours->end());
+}
+
+// Rejects collapses that would fold a face over or pinch the surface into a non-manifold edge
+static bool CanCollapse(const Simplifier& s, const Collapse& c, std::vector<uint32_t>* from_neighbours, std::vector<uint32_t>* to_neighbours)
+{
+	GatherNeighbours(s, c.from, from_neighbours);
+	GatherNeighbours(s, c.to, to_neighbours);
+	size_t shared = 0;
+	for (uint32_t n : *from_neighbours)
+		shared += std::binary_search(to_neighbours->begin(), to_neighbours->end(), n);
+	if (shared > 2) return false;
+
+	for (uint32_t v : { c.from, c.to })
+	{
+		for (uint32_t f : s.vertex_faces[v])
+		{
+			if (s.faces_removed[f] || !FaceUses(s, f, v)) continue;
+			if (FaceUses(s, f, c.from) && FaceUses(s, f, c.to)) continue;	// Removed by the collapse
+
+			Vector3 before[3], after[3];
+			for (int i = 0; i < 3; i++)
+			{
+				uint32_t corner = s.faces[f * 3 + i];
+				before[i] = s.positions[corner];
+				after[i] = corner == v ? c.position : before[i];
+			}
+			Vector3 n0 = Vector3Normalize(FaceCross(before[0], before[1], before[2]));
+			Vector3 n1 = Vector3Normalize(FaceCross(after[0], after[1], after[2]));
+			if (Vector3DotProduct(n0, n1) < LOD_MIN_FLIP_COS) return false;
+		}
+	}
+	return true;
+}
+
+static void ApplyCollapse(Simplifier& s, const Collapse& c)
+{
+	s.positions[c.to] = c.position;
+	s.quadrics[c.to].Add(s.quadrics[c.from]);
+	s.versions[c.to]++;
+	s.removed[c.from] = true;
+
+	for (uint32_t f : s.vertex_faces[c.from])
+	{
+		if (s.faces_removed[f] || !FaceUses(s, f, c.from)) continue;
+		if (FaceUses(s, f, c.to))
+		{
+			s.faces_removed[f] = true;
+			s.face_count--;
+			continue;
+		}
+
+		for (int i = 0; i < 3; i++)
+		{
+			if (s.faces[f * 3 + i] == c.from)
+				s.faces[f * 3 + i] = c.to;
+		}
+		s.vertex_faces[c.to].push_back(f);
+	}
+	s.vertex_faces[c.from].clear();
+}
+
+// Copies the surviving faces into lod, dropping vertices nothing uses anymore
+static void BuildLod(const Simplifier& s, Mesh* lod)
+{
+	std::vector<uint32_t> remap(s.positions.size(), ~0u);
+	std::vector<Vector3> positions;
+	std::vector<uint16_t> indices;
+	for (size_t f = 0; f < s.faces_removed.size(); f++)
+	{
+		if (s.faces_removed[f]) continue;
+		for (int i = 0; i < 3; i++)
+		{
+			uint32_t v = s.faces[f * 3 + i];
+			if (remap[v] == ~0u)
+			{
+				remap[v] = (uint32_t)positions.size();
+				positions.push_back(s.positions[v]);
+			}
+			indices.push_back((uint16_t)remap[v]);
+		}
+	}
+	MeshTriangulate(lod, positions, indices);
+}
+
+void MeshBuildLods(Mesh* mesh)
+{
+	mesh->lods.clear();
+	if (mesh->face_count < MESH_LOD_MIN_FACES * 2) return;
+
+	// Faces store their own copy of each corner, so corners at the same position are welded back into shared vertices
+	Simplifier s;
+	MeshWeld(*mesh, &s.positions, &s.faces);
+
+	// LODs are built with 16-bit indices like every other mesh
+	size_t vertex_count = s.positions.size();
+	if (vertex_count > UINT16_MAX + 1) return;
+
+	s.quadrics.resize(vertex_count);
+	s.versions.resize(vertex_count);
+	s.removed.resize(vertex_count);
+	s.vertex_faces.resize(vertex_count);
+	s.faces_removed.resize(mesh->face_count);
+	s.face_count = mesh->face_count;
+
+	// Every vertex starts with the planes of its faces. They're unweighted so a collapse's cost stays a sum of squared distances,
+	// which lod_error turns back into a distance
+	std::unordered_map<uint64_t, int> edge_uses;
+	for (uint32_t f = 0; f < mesh->face_count; f++)
+	{
+		const uint32_t* v = &s.faces[f * 3];
+		Vector3 n = Vector3Normalize(FaceCross(s.positions[v[0]], s.positions[v[1]], s.positions[v[2]]));
+		float d = -Vector3DotProduct(n, s.positions[v[0]]);
+		for (int i = 0; i < 3; i++)
+		{
+			s.quadrics[v[i]].AddPlane(n, d, 1.0);
+			s.vertex_faces[v[i]].push_back(f);
+
+			uint32_t a = std::min(v[i], v[(i + 1) % 3]);
+			uint32_t b = std::max(v[i], v[(i + 1) % 3]);
+			edge_uses[(uint64_t)a << 32 | b]++;
+		}
+	}
+
+	// Edges used by a single face are on the boundary. A plane through the edge, perpendicular to its face, pins them in place
+	for (uint32_t f = 0; f < mesh->face_count; f++)
+	{
+		const uint32_t* v = &s.faces[f * 3];
+		Vector3 face_normal = Vector3Normalize(FaceCross(s.positions[v[0]], s.positions[v[1]], s.positions[v[2]]));
+		for (int i = 0; i < 3; i++)
+		{
+			uint32_t a = v[i];
+			uint32_t b = v[(i + 1) % 3];
+			if (edge_uses[(uint64_t)std::min(a, b) << 32 | std::max(a, b)] != 1) continue;
+
+			Vector3 edge = s.positions[b] - s.positions[a];
+			Vector3 n = Vector3Normalize(Vector3CrossProduct(edge, face_normal));
+			float d = -Vector3DotProduct(n, s.positions[a]);
+			s.quadrics[a].AddPlane(n, d, LOD_BOUNDARY_WEIGHT);
+			s.quadrics[b].AddPlane(n, d, LOD_BOUNDARY_WEIGHT);
+		}
+	}
+
+	for (uint32_t f = 0; f < mesh->face_count; f++)
+	{
+		for (int i = 0; i < 3; i++)
+			QueueCollapse(s, s.faces[f * 3 + i], s.faces[f * 3 + (i + 1) % 3]);
+	}
+
+	// Collapse the cheapest edge until the face count halves, snapshot a LOD and keep going from there
+	double max_cost = 0.0;
+	size_t target = mesh->face_count / 2;
+	std::vector<uint32_t> from_neighbours, to_neighbours, neighbours;
+	while (!s.queue.empty() && (int)mesh->lods.size() < MESH_LOD_MAX_LEVELS)
+	{
+		Collapse c = s.queue.top();
+		s.queue.pop();
+		if (s.removed[c.from] || s.removed[c.to]) continue;
+		if (s.versions[c.from] != c.from_version || s.versions[c.to] != c.to_version) continue;
+		if (!CanCollapse(s, c, &from_neighbours, &to_neighbours)) continue;
+
+		ApplyCollapse(s, c);
+		max_cost = std::max(max_cost, c.cost);
+
+		// The survivor's version changed, so every collapse queued with it is stale. Both directions are queued again,
+		// or it could only ever absorb its neighbours and never be merged into one of them
+		GatherNeighbours(s, c.to, &neighbours);
+		for (uint32_t n : neighbours)
+		{
+			QueueCollapse(s, n, c.to);
+			QueueCollapse(s, c.to, n);
+		}
+
+		if (s.face_count <= target)
+		{
+			mesh->lods.emplace_back();
+			Mesh& lod = mesh->lods.back();
+			BuildLod(s, &lod);
+			lod.lod_error = (float)sqrt(max_cost);
+
+			target = s.face_count / 2;
+			if (target < MESH_LOD_MIN_FACES) break;
+		}
+	}
+}
@@ -0,0 +1,166 @@
+#include "Mesh.h"
+#include <algorithm>
+#include <cassert>
+
+// Below this, the faces of a meshlet point too many ways for its normal cone to ever cull it
+static constexpr float MESHLET_MIN_CONE_COS = 0.1f;
+
+// Grows each meshlet from a seed face, always adding the neighbouring face whose normal is closest to the meshlet's average.
+// Faces only need to share a vertex to be neighbours. When a meshlet runs out of neighbours it continues from the next unused face
+static void ClusterFaces(const Mesh& mesh, std::vector<uint32_t>* order)
+{
+	std::vector<Vector3> positions;
+	std::vector<uint32_t> indices;
+	MeshWeld(mesh, &positions, &indices);
+
+	// Faces using each vertex are vertex_faces[vertex_offsets[v], vertex_offsets[v + 1])
+	std::vector<uint32_t> vertex_offsets(positions.size() + 1, 0);
+	std::vector<uint32_t> vertex_faces(indices.size());
+	for (uint32_t v : indices)
+		vertex_offsets[v + 1]++;
+	for (size_t v = 0; v < positions.size(); v++)
+		vertex_offsets[v + 1] += vertex_offsets[v];
+	std::vector<uint32_t> cursors(vertex_offsets.begin(), vertex_offsets.end() - 1);
+	for (size_t i = 0; i < indices.size(); i++)
+		vertex_faces[cursors[indices[i]]++] = (uint32_t)(i / 3);
+
+	size_t face_count = mesh.face_count;
+	std::vector<bool> assigned(face_count);
+	std::vector<uint32_t> frontier_meshlet(face_count, ~0u);	// Which meshlet's frontier a face was last added to
+	std::vector<uint32_t> frontier;
+	size_t seed = 0;
+	order->clear();
+	order->reserve(face_count);
+	while (order->size() < face_count)
+	{
+		uint32_t meshlet = (uint32_t)(order->size() / MESH_MESHLET_FACES);
+		size_t meshlet_end = std::min(order->size() + MESH_MESHLET_FACES, face_count);
+		Vector3 normal_sum = Vector3Zeros;
+		frontier.clear();
+		while (order->size() < meshlet_end)
+		{
+			uint32_t face;
+			if (frontier.empty())
+			{
+				while (assigned[seed])
+					seed++;
+				face = (uint32_t)seed;
+			}
+			else
+			{
+				Vector3 axis = Vector3Normalize(normal_sum);
+				size_t best = 0;
+				float best_dot = -INFINITY;
+				for (size_t i = 0; i < frontier.size(); i++)
+				{
+					float d = Vector3DotProduct(mesh.normals[frontier[i]], axis);
+					if (d > best_dot)
+					{
+						best = i;
+						best_dot = d;
+					}
+				}
+				face = frontier[best];
+				frontier[best] = frontier.back();
+				frontier.pop_back();
+			}
+
+			assigned[face] = true;
+			order->push_back(face);
+			normal_sum += mesh.normals[face];
+			for (int j = 0; j < 3; j++)
+			{
+				uint32_t v = indices[face * 3 + j];
+				for (uint32_t k = vertex_offsets[v]; k < vertex_offsets[v + 1]; k++)
+				{
+					uint32_t neighbour = vertex_faces[k];
+					if (assigned[neighbour] || frontier_meshlet[neighbour] == meshlet) continue;
+					frontier_meshlet[neighbour] = meshlet;
+					frontier.push_back(neighbour);
+				}
+			}
+		}
+	}
+}
+
+// Moves each face's run of per_face values to where order puts the face. Empty vectors are left alone
+template<typename T>
+static void PermuteFaces(std::vector<T>* values, const std::vector<uint32_t>& order, size_t per_face)
+{
+	if (values->empty()) return;
+	std::vector<T> permuted(values->size());
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		for (size_t j = 0; j < per_face; j++)
+			permuted[i * per_face + j] = (*values)[order[i] * per_face + j];
+	}
+	values->swap(permuted);
+}
+
+// Reorders mesh's faces into meshlets. Positions are reordered if kept, the indexed copy only has its indices reordered
+static void ReorderFaces(Mesh* mesh)
+{
+	std::vector<uint32_t> order;
+	ClusterFaces(*mesh, &order);
+
+	PermuteFaces(&mesh->positions, order, 3);
+	PermuteFaces(&mesh->normals, order, 1);
+	PermuteFaces(&mesh->indices_16, order, 3);
+	PermuteFaces(&mesh->indices_32, order, 3);
+	PermuteFaces(&mesh->normals_oct_8, order, 1);
+	PermuteFaces(&mesh->normals_oct_16, order, 1);
+	mesh->bvh_nodes.clear();
+	mesh->bvh_faces.clear();
+	if (mesh->vertex_count == 0)
+		MeshBuildSoA(mesh);
+	else
+		MeshMarkChanged(mesh);
+}
+
+void MeshBuildMeshlets(Mesh* mesh, bool cluster)
+{
+	mesh->meshlets.clear();
+	if (mesh->face_count == 0) return;
+	assert(mesh->normals.size() == mesh->face_count);
+	if (cluster)
+		ReorderFaces(mesh);
+
+	size_t meshlet_count = (mesh->face_count + MESH_MESHLET_FACES - 1) / MESH_MESHLET_FACES;
+	mesh->meshlets.resize(meshlet_count);
+	for (size_t m = 0; m < meshlet_count; m++)
+	{
+		size_t begin = m * MESH_MESHLET_FACES;
+		size_t end = std::min(begin + MESH_MESHLET_FACES, mesh->face_count);
+		Meshlet& meshlet = mesh->meshlets[m];
+
+		Vector3 lo = { INFINITY, INFINITY, INFINITY };
+		Vector3 hi = { -INFINITY, -INFINITY, -INFINITY };
+		Vector3 normal_sum = Vector3Zeros;
+		for (size_t f = begin; f < end; f++)
+		{
+			for (size_t v = f * 3; v < f * 3 + 3; v++)
+			{
+				Vector3 p = MeshCorner(*mesh, v);
+				lo = Vector3Min(lo, p);
+				hi = Vector3Max(hi, p);
+			}
+			normal_sum += mesh->normals[f];
+		}
+
+		meshlet.center = (lo + hi) * 0.5f;
+		meshlet.radius = 0.0f;
+		for (size_t v = begin * 3; v < end * 3; v++)
+			meshlet.radius = fmaxf(meshlet.radius, Vector3Distance(meshlet.center, MeshCorner(*mesh, v)));
+
+		// Degenerate faces have no normal. They never survive backface culling, so they don't widen the cone
+		meshlet.cone_axis = Vector3Normalize(normal_sum);
+		float min_cos = 1.0f;
+		for (size_t f = begin; f < end; f++)
+		{
+			if (Vector3LengthSqr(mesh->normals[f]) > 0.0f)
+				min_cos = fminf(min_cos, Vector3DotProduct(mesh->normals[f], meshlet.cone_axis));
+		}
+		bool cullable = Vector3LengthSqr(meshlet.cone_axis) > 0.0f && min_cos >= MESHLET_MIN_CONE_COS;
+		meshlet.cone_cutoff = cullable ? sqrtf(1.0f - min_cos * min_cos) : 1.0f;
+	}
+}
@@ -0,0 +1,265 @@
+#include "Rasterizer.h"
+#include <algorithm>
+#include <cstdio>
+
+void FramebufferCreate(Framebuffer* fb, int width, int height, FramebufferFormat format)
+{
+	fb->width = width;
+	fb->height = height;
+	fb->format = format;
+	fb->color.resize(format == FRAMEBUFFER_RGBA8 ? width * height : 0);
+	fb->color_float.resize(format == FRAMEBUFFER_RGBA32F ? width * height * 4 : 0);
+	fb->depth.resize(width * height);
+	FramebufferClear(fb);
+}
+
+void FramebufferClear(Framebuffer* fb, uint32_t color, float depth)
+{
+	if (fb->format == FRAMEBUFFER_RGBA8)
+	{
+		std::fill(fb->color.begin(), fb->color.end(), color);
+	}
+	else
+	{
+		float rgba[4];
+		for (int i = 0; i < 4; i++)
+			rgba[i] = ((color >> (i * 8)) & 0xFF) / 255.0f;
+		for (size_t i = 0; i < fb->color_float.size(); i++)
+			fb->color_float[i] = rgba[i % 4];
+	}
+	std::fill(fb->depth.begin(), fb->depth.end(), depth);
+}
+
+void FramebufferUnload(Framebuffer* fb)
+{
+	fb->color.resize(0);
+	fb->color_float.resize(0);
+	fb->depth.resize(0);
+	fb->width = fb->height = 0;
+}
+
+uint32_t FramebufferGetPixel(const Framebuffer& fb, int x, int y)
+{
+	size_t pixel = y * fb.width + x;
+	if (fb.format == FRAMEBUFFER_RGBA8)
+		return fb.color[pixel];
+
+	const float* c = fb.color_float.data() + pixel * 4;
+	uint32_t a = (uint32_t)(Clamp(c[3], 0.0f, 1.0f) * 255.0f + 0.5f);
+	return (ColorPack({ c[0], c[1], c[2] }) & 0x00FFFFFF) | (a << 24);
+}
+
+bool FramebufferSavePPM(const Framebuffer& fb, const char* path)
+{
+	FILE* file = fopen(path, "wb");
+	if (file == nullptr) return false;
+
+	// PPM stores rows top to bottom
+	fprintf(file, "P6\n%d %d\n255\n", fb.width, fb.height);
+	std::vector<uint8_t> row(fb.width * 3);
+	for (int y = fb.height - 1; y >= 0; y--)
+	{
+		for (int x = 0; x < fb.width; x++)
+		{
+			uint32_t c = FramebufferGetPixel(fb, x, y);
+			row[x * 3 + 0] = c & 0xFF;
+			row[x * 3 + 1] = (c >> 8) & 0xFF;
+			row[x * 3 + 2] = (c >> 16) & 0xFF;
+		}
+		fwrite(row.data(), 1, row.size(), file);
+	}
+
+	bool success = ferror(file) == 0;
+	fclose(file);
+	return success;
+}
+
+static void WriteLE(uint8_t* dst, uint32_t value, int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+		dst[i] = (value >> (i * 8)) & 0xFF;
+}
+
+bool FramebufferSaveBMP(const Framebuffer& fb, const char* path)
+{
+	FILE* file = fopen(path, "wb");
+	if (file == nullptr) return false;
+
+	// BMP stores rows bottom to top (same as the framebuffer) as BGR, each row padded to 4 bytes
+	uint32_t row_size = (fb.width * 3 + 3) & ~3u;
+	uint32_t image_size = row_size * fb.height;
+	uint8_t header[54] = {};
+	header[0] = 'B';
+	header[1] = 'M';
+	WriteLE(header + 2, sizeof(header) + image_size, 4);	// File size
+	WriteLE(header + 10, sizeof(header), 4);				// Offset to the pixels
+	WriteLE(header + 14, 40, 4);							// BITMAPINFOHEADER size
+	WriteLE(header + 18, fb.width, 4);
+	WriteLE(header + 22, fb.height, 4);
+	WriteLE(header + 26, 1, 2);								// Planes
+	WriteLE(header + 28, 24, 2);							// Bits per pixel
+	WriteLE(header + 34, image_size, 4);
+	fwrite(header, 1, sizeof(header), file);
+
+	std::vector<uint8_t> row(row_size, 0);
+	for (int y = 0; y < fb.height; y++)
+	{
+		for (int x = 0; x < fb.width; x++)
+		{
+			uint32_t c = FramebufferGetPixel(fb, x, y);
+			row[x * 3 + 0] = (c >> 16) & 0xFF;
+			row[x * 3 + 1] = (c >> 8) & 0xFF;
+			row[x * 3 + 2] = c & 0xFF;
+		}
+		fwrite(row.data(), 1, row.size(), file);
+	}
+
+	bool success = ferror(file) == 0;
+	fclose(file);
+	return success;
+}
+
+static inline Vector3 NdcToScreen(const Framebuffer& fb, Vector3 v)
+{
+	return { (v.x * 0.5f + 0.5f) * fb.width, (v.y * 0.5f + 0.5f) * fb.height, v.z };
+}
+
+bool RasterBounds(const Framebuffer& fb, Vector3 v0, Vector3 v1, Vector3 v2, RasterRect* bounds)
+{
+	Vector3 a = NdcToScreen(fb, v0);
+	Vector3 b = NdcToScreen(fb, v1);
+	Vector3 c = NdcToScreen(fb, v2);
+	float x_min = fminf(a.x, fminf(b.x, c.x));
+	float y_min = fminf(a.y, fminf(b.y, c.y));
+	float x_max = fmaxf(a.x, fmaxf(b.x, c.x));
+	float y_max = fmaxf(a.y, fmaxf(b.y, c.y));
+
+	// Also rejects NaNs
+	if (!(x_max >= 0.0f && y_max >= 0.0f && x_min < fb.width && y_min < fb.height)) return false;
+
+	// Conservative, covers every pixel the triangle's edges (as lines) could touch too. Clamped in float so huge values can't overflow
+	bounds->x_min = (int)Clamp(floorf(x_min), 0.0f, (float)fb.width - 1.0f);
+	bounds->y_min = (int)Clamp(floorf(y_min), 0.0f, (float)fb.height - 1.0f);
+	bounds->x_max = (int)Clamp(floorf(x_max), 0.0f, (float)fb.width - 1.0f) + 1;
+	bounds->y_max = (int)Clamp(floorf(y_max), 0.0f, (float)fb.height - 1.0f) + 1;
+	return true;
+}
+
+// Fills pixels [x_min, x_max) of row y. Depth is evaluated from the row's base rather than stepped from the first pixel,
+// so a pixel's depth doesn't depend on where the span was scissored
+static inline void RasterSpan(Framebuffer* fb, int y, int x_min, int x_max, float z_row, float dzdx, Vector3 color, uint32_t packed, bool depth_test)
+{
+	float* depth_row = fb->depth.data() + y * fb->width;
+	if (fb->format == FRAMEBUFFER_RGBA8)
+	{
+		uint32_t* color_row = fb->color.data() + y * fb->width;
+		for (int x = x_min; x < x_max; x++)
+		{
+			float z = z_row + dzdx * (x + 0.5f);
+			if (!depth_test || z < depth_row[x])
+			{
+				depth_row[x] = z;
+				color_row[x] = packed;
+			}
+		}
+	}
+	else
+	{
+		float* color_row = fb->color_float.data() + y * fb->width * 4;
+		for (int x = x_min; x < x_max; x++)
+		{
+			float z = z_row + dzdx * (x + 0.5f);
+			if (!depth_test || z < depth_row[x])
+			{
+				depth_row[x] = z;
+				color_row[x * 4 + 0] = color.x;
+				color_row[x * 4 + 1] = color.y;
+				color_row[x * 4 + 2] = color.z;
+				color_row[x * 4 + 3] = 1.0f;
+			}
+		}
+	}
+}
+
+// Scanline rasterization -- a pixel is covered if its center lies within [left, right) x [top, bottom) of the triangle.
+// Depth is affine in screen-space after the perspective divide, so it's evaluated from the plane's x and y gradients.
+void RasterTriangle(Framebuffer* fb, Vector3 v0, Vector3 v1, Vector3 v2, Vector3 color, bool depth_test, const RasterRect* scissor)
+{
+	RasterRect rect = scissor != nullptr ? *scissor : RasterRect{ 0, 0, fb->width, fb->height };
+
+	Vector3 a = NdcToScreen(*fb, v0);
+	Vector3 b = NdcToScreen(*fb, v1);
+	Vector3 c = NdcToScreen(*fb, v2);
+
+	// Sort vertices top to bottom so a->c is the long edge
+	if (b.y < a.y) std::swap(a, b);
+	if (c.y < a.y) std::swap(a, c);
+	if (c.y < b.y) std::swap(b, c);
+
+	// Also rejects NaNs
+	float area = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+	if (!(fabsf(area) > 0.0f)) return;
+
+	float dzdx = ((b.z - a.z) * (c.y - a.y) - (c.z - a.z) * (b.y - a.y)) / area;
+	float dzdy = ((c.z - a.z) * (b.x - a.x) - (b.z - a.z) * (c.x - a.x)) / area;
+	uint32_t packed = ColorPack(color);
+
+	int y_min = (int)Clamp(ceilf(a.y - 0.5f), (float)rect.y_min, (float)rect.y_max);
+	int y_max = (int)Clamp(ceilf(c.y - 0.5f), (float)rect.y_min, (float)rect.y_max);
+	for (int y = y_min; y < y_max; y++)
+	{
+		float py = y + 0.5f;
+		float x_long = a.x + (c.x - a.x) * (py - a.y) / (c.y - a.y);
+		float x_short = py < b.y ?
+			a.x + (b.x - a.x) * (py - a.y) / (b.y - a.y) :
+			b.x + (c.x - b.x) * (py - b.y) / (c.y - b.y);
+
+		float x_left = fminf(x_long, x_short);
+		float x_right = fmaxf(x_long, x_short);
+		int x_min = (int)Clamp(ceilf(x_left - 0.5f), (float)rect.x_min, (float)rect.x_max);
+		int x_max = (int)Clamp(ceilf(x_right - 0.5f), (float)rect.x_min, (float)rect.x_max);
+
+		float z_row = a.z - dzdx * a.x + dzdy * (py - a.y);
+		RasterSpan(fb, y, x_min, x_max, z_row, dzdx, color, packed, depth_test);
+	}
+}
+
+void RasterLine(Framebuffer* fb, Vector3 v0, Vector3 v1, Vector3 color, bool depth_test, const RasterRect* scissor)
+{
+	RasterRect rect = scissor != nullptr ? *scissor : RasterRect{ 0, 0, fb->width, fb->height };
+
+	Vector3 a = NdcToScreen(*fb, v0);
+	Vector3 b = NdcToScreen(*fb, v1);
+
+	// Also rejects NaNs
+	float steps = fmaxf(fabsf(b.x - a.x), fabsf(b.y - a.y));
+	if (!(steps >= 0.0f)) return;
+
+	// Walk at most one pixel per step along the major axis, clamped so off-screen lines can't stall the frame
+	int n = (int)fminf(ceilf(steps), (float)(fb->width + fb->height)) + 1;
+	Vector3 d = (b - a) / (float)n;
+	Vector3 p = a;
+	uint32_t packed = ColorPack(color);
+	for (int i = 0; i <= n; i++, p += d)
+	{
+		if (!(p.x >= rect.x_min && p.y >= rect.y_min && p.x < rect.x_max && p.y < rect.y_max)) continue;
+
+		size_t pixel = (int)p.y * fb->width + (int)p.x;
+		if (!depth_test || p.z <= fb->depth[pixel])
+		{
+			fb->depth[pixel] = p.z;
+			if (fb->format == FRAMEBUFFER_RGBA8)
+			{
+				fb->color[pixel] = packed;
+			}
+			else
+			{
+				float* c = fb->color_float.data() + pixel * 4;
+				c[0] = color.x;
+				c[1] = color.y;
+				c[2] = color.z;
+				c[3] = 1.0f;
+			}
+		}
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "raymath.h"
+// All "Rasterizer" functions operate on a Framebuffer and take vertices in normalized device coordinates ([-1, 1] on every axis)
+
+enum FramebufferFormat
+{
+	FRAMEBUFFER_RGBA8,		// 8 bits per channel, the format App::DrawPixels displays
+	FRAMEBUFFER_RGBA32F		// A float per channel, unclamped (ie for comparing shader output exactly)
+};
+
+struct Framebuffer
+{
+	int width = 0;
+	int height = 0;
+	FramebufferFormat format = FRAMEBUFFER_RGBA8;
+	std::vector<uint32_t> color;		// RGBA8 only. Red in the lowest byte. Row 0 is the bottom of the screen (same as OpenGL)
+	std::vector<float> color_float;		// RGBA32F only. 4 floats per pixel, same layout as color
+	std::vector<float> depth;			// NDC depth, smaller is closer
+};
+
+void FramebufferCreate(Framebuffer* fb, int width, int height, FramebufferFormat format = FRAMEBUFFER_RGBA8);
+void FramebufferClear(Framebuffer* fb, uint32_t color = 0xFF000000, float depth = 1.0f);
+void FramebufferUnload(Framebuffer* fb);
+
+// Pixel (x, y) as RGBA8, converting (and clamping) float framebuffers
+uint32_t FramebufferGetPixel(const Framebuffer& fb, int x, int y);
+
+// Writes the color buffer as a binary PPM or a 24-bit BMP. Returns false if the file couldn't be written
+bool FramebufferSavePPM(const Framebuffer& fb, const char* path);
+bool FramebufferSaveBMP(const Framebuffer& fb, const char* path);
+
+// Pixels [x_min, x_max) x [y_min, y_max)
+struct RasterRect
+{
+	int x_min, y_min;
+	int x_max, y_max;
+};
+
+// Flat-shaded triangle. Winding doesn't matter (culling is the caller's job).
+// Without depth_test every pixel is overwritten in submission order, like the painter's modes drawing through OpenGL.
+// Only pixels inside scissor (if given) are touched, and they get exactly the values they'd get without it,
+// so threads can rasterize disjoint tiles of the same framebuffer without locking
+void RasterTriangle(Framebuffer* fb, Vector3 v0, Vector3 v1, Vector3 v2, Vector3 color, bool depth_test = true, const RasterRect* scissor = nullptr);
+
+// Line used for wireframe rendering
+void RasterLine(Framebuffer* fb, Vector3 v0, Vector3 v1, Vector3 color, bool depth_test = true, const RasterRect* scissor = nullptr);
+
+// Pixels a triangle can cover, or false if it's entirely off-screen (or NaN)
+bool RasterBounds(const Framebuffer& fb, Vector3 v0, Vector3 v1, Vector3 v2, RasterRect* bounds);
+
+inline uint32_t ColorPack(Vector3 c)
+{
+	uint32_t r = (uint32_t)(Clamp(c.x, 0.0f, 1.0f) * 255.0f + 0.5f);
+	uint32_t g = (uint32_t)(Clamp(c.y, 0.0f, 1.0f) * 255.0f + 0.5f);
+	uint32_t b = (uint32_t)(Clamp(c.z, 0.0f, 1.0f) * 255.0f + 0.5f);
+	return r | (g << 8) | (b << 16) | 0xFF000000;
+}
@@ -0,0 +1,159 @@
+#pragma once
+#include "Renderer.h"
+#include "Rasterizer.h"
+#include "Sort.h"
+#include "Workspace.h"
+// Renderer internals shared between the Draw* translation units. Game code should only need Renderer.h
+
+// A face (or part of one after clipping) that survived culling, ready to be sorted and submitted.
+// Its mesh face index and color are kept in separate arrays so the shading stage reads and writes them densely
+struct Face
+{
+	Vector3 positions_clip[3];
+};
+
+// Last frame's back-to-front face order of one mesh (or of the draw queue), for RENDER_MODE_PAINTER_COHERENT
+struct SortHistory
+{
+	const void* owner = nullptr;
+	size_t mesh_face_count = 0;	// Face numbers in use (mesh faces times instances), 0 until an order has been recorded
+	size_t face_count = 0;		// Faces that were visible, and so are in order
+	uint64_t last_frame = 0;
+	Workspace<uint32_t> order;	// Face numbers, back to front
+};
+
+constexpr int SORT_HISTORY_COUNT = 16;
+
+// Transformed vertices of one mesh, reused for as long as it's drawn with bitwise identical matrices (ie a static prop and a still camera).
+// Only faces that weren't culled are transformed, so valid tracks which blocks of MESH_MESHLET_FACES faces (or vertices, if the mesh is indexed) are up to date
+struct TransformCache
+{
+	const Mesh* mesh = nullptr;
+	uint64_t generation = 0;	// Mesh::generation when transformed, the vertices have changed since if it no longer matches
+	Matrix world = {};
+	Matrix mvp = {};
+	uint64_t last_frame = 0;
+	Workspace<float> world_x, world_y, world_z;	// Padded like Mesh::soa_x (or Mesh::vertex_x)
+	Workspace<float> clip_x, clip_y, clip_z, clip_w;
+	Workspace<uint8_t> valid;
+};
+
+constexpr int TRANSFORM_CACHE_COUNT = 32;
+
+// Painter's mode triangles in submission order, laid out for App::DrawTriangles.
+// Drawn by DrawEnd in a single call, or earlier if the wireframe setting changes or the stream has to grow
+struct TriangleStream
+{
+	Workspace<float> xy;	// 2 floats per vertex
+	Workspace<float> rgb;	// 3 floats per vertex
+	size_t count = 0;		// Triangles queued
+	bool wireframe = false;
+};
+
+constexpr int DEPTH_PYRAMID_BLOCK_SIZE = 8;	// Pixels per level 0 texel along each axis
+constexpr int DEPTH_PYRAMID_MAX_LEVELS = 16;
+
+// Hierarchical-Z pyramid built by DrawBuildOcclusion. Every texel holds the farthest depth of the pixels it covers,
+// so anything nearer than a texel can't be hidden by it and anything farther than all of a mesh's texels is
+struct DepthPyramid
+{
+	const Framebuffer* source = nullptr;	// nullptr while there's no pyramid this frame
+	int levels = 0;
+	int width[DEPTH_PYRAMID_MAX_LEVELS] = {};
+	int height[DEPTH_PYRAMID_MAX_LEVELS] = {};
+	size_t offset[DEPTH_PYRAMID_MAX_LEVELS] = {};	// Start of each level in depth
+	Workspace<float> depth;
+};
+
+// Everything a meshlet is tested against, in the mesh's local space
+struct MeshletCuller
+{
+	Vector4 planes[6];	// Frustum planes, normalized so a plane's dot product with (p, 1) is a distance. Positive inside
+	Vector3 camera;
+	bool cones;			// Cone culling can't be used when the world matrix mirrors the mesh, that changes which side is the front
+};
+
+// A DrawQueue call, drawn when the queue is flushed
+struct QueuedDraw
+{
+	const Mesh* mesh;
+	UniformData data;
+	FragmentShader fragment_shader;	// One of the two shaders is set
+	BatchShader batch_shader;
+	bool wireframe;
+	uint32_t first_face;	// Where the draw's faces start in the flushed queue's faces
+};
+
+// Owns every buffer the renderer writes to so nothing is allocated per-frame.
+// Workspaces grow to fit the largest mesh drawn so far and are then reused by every DrawMesh call.
+struct RenderContext
+{
+	RenderMode mode = RENDER_MODE_DEPTH;
+	Framebuffer framebuffer;		// Depth mode's output when drawing to the window
+	Framebuffer* target = nullptr;	// Set by DrawSetTarget, replaces the window for every mode
+
+	// Per-vertex output of the transform stage, padded like Mesh::soa_x. Only used by instanced draws, other meshes are transformed into their cache
+	Workspace<float> world_x, world_y, world_z;
+	Workspace<float> clip_x, clip_y, clip_z, clip_w;
+
+	// Least-recently drawn meshes are evicted when more than TRANSFORM_CACHE_COUNT are drawn
+	TransformCache transform_cache[TRANSFORM_CACHE_COUNT];
+
+	// Matrices of every instance being drawn (just data's, for DrawMesh), and whether the instance's bounds were culled
+	Workspace<Matrix> instance_world;
+	Workspace<Matrix> instance_mvp;
+	Workspace<Matrix> instance_normal;
+	Workspace<uint8_t> instance_culled;
+	Workspace<MeshletCuller> instance_cullers;	// Meshlet meshes only
+
+	// DrawGroupInstances' output -- the LOD each instance needs, and the instances' matrices grouped by it
+	Workspace<int8_t> lod_levels;
+	Workspace<Matrix> lod_instances;
+
+	// Face numbers (see MeshBatch) that survived culling, and that cross the near plane.
+	// Each job compacts into its own chunk, then the chunks are closed up
+	Workspace<uint32_t> visible;
+	Workspace<uint32_t> near;
+	Workspace<uint32_t> chunk_visible_counts;
+	Workspace<uint32_t> chunk_near_counts;
+
+	Workspace<Face> faces;
+	Workspace<uint32_t> face_indices;	// Face number of each face
+	Workspace<float> color_x, color_y, color_z;	// Written by the shading stage
+
+	// Painter's mode only -- (depth, face index) pairs and the radix sort's scratch buffer
+	Workspace<SortKey> sort_keys;
+	Workspace<SortKey> sort_temp;
+	Workspace<uint32_t> face_slots;	// Coherent mode only, visible face of each face number
+	TriangleStream triangles;
+	DepthPyramid depth_pyramid;
+
+	// CPU back end's tile bins. Tile t's faces are tile_faces[tile_offsets[t], tile_offsets[t + 1])
+	Workspace<RasterRect> face_tiles;	// Range of tiles each face overlaps
+	Workspace<uint32_t> tile_offsets;
+	Workspace<uint32_t> tile_cursors;
+	Workspace<uint32_t> tile_faces;
+
+	// Draws waiting for DrawEnd. Kept when the workspace grows, unlike the others
+	Workspace<QueuedDraw> queue;
+	size_t queue_count = 0;
+
+	// Least-recently drawn meshes are evicted when more than SORT_HISTORY_COUNT are drawn with coherent sorting
+	SortHistory sort_history[SORT_HISTORY_COUNT];
+	uint64_t frame = 0;
+
+	RenderStats stats;
+};
+
+// Grows ws to hold count elements, keeping the first keep, recording any heap allocation in the context's stats
+template<typename T>
+inline void RenderReserve(RenderContext* ctx, Workspace<T>* ws, size_t count, size_t keep = 0)
+{
+	size_t old_bytes = ws->Bytes();
+	if (ws->Reserve(count, keep))
+	{
+		ctx->stats.frame_allocations++;
+		ctx->stats.total_allocations++;
+		ctx->stats.workspace_bytes += ws->Bytes() - old_bytes;
+	}
+}
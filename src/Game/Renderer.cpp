@@ -1,60 +1,1271 @@
-#include "Renderer.h"
+#include "RenderContext.h"
+#include "Clip.h"
+#include "Jobs.h"
+#include "Transform.h"
 #include "../ContestAPI/app.h"
 #include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
 
-struct Face
+static_assert(DRAW_CHUNK_SIZE * 3 % TRANSFORM_SIMD_WIDTH == 0, "Chunks must start on a SIMD boundary of the vertex streams");
+static_assert(MESH_MESHLET_FACES * 3 % TRANSFORM_SIMD_WIDTH == 0, "Meshlets must start on a SIMD boundary of the vertex streams");
+static_assert(DRAW_CHUNK_SIZE % MESH_MESHLET_FACES == 0, "Chunks must hold whole meshlets");
+
+// Screen tiles rasterized per job by the CPU back end. 64x64 pixels of color and depth is 32KB, about an L1 cache
+static constexpr int DRAW_TILE_SIZE = 64;
+
+// Instances set up per job. Each one inverts a couple of matrices and projects its bounds
+static constexpr size_t DRAW_INSTANCE_CHUNK_SIZE = 64;
+
+static RenderContext context;
+
+static void FlushQueue();
+
+const RenderStats& DrawGetStats()
 {
-	Vector3 positions_world[3];
-	Vector3 positions_clip[3];
-	Vector3 normal_world;
-};
+	return context.stats;
+}
 
-void DrawMesh(const Mesh& mesh, const UniformData& data, FragmentShader shader, bool wireframe)
+void DrawSetMode(RenderMode mode)
+{
+	context.mode = mode;
+}
+
+RenderMode DrawGetMode()
+{
+	return context.mode;
+}
+
+void DrawSetTarget(Framebuffer* target)
+{
+	context.target = target;
+}
+
+Framebuffer* DrawGetTarget()
+{
+	return context.target;
+}
+
+void DrawBegin()
+{
+	context.stats.frame_allocations = 0;
+	context.stats.frame_faces = 0;
+	context.stats.frame_faces_visible = 0;
+	context.stats.frame_faces_clipped = 0;
+	context.stats.frame_draw_calls = 0;
+	context.stats.frame_meshes = 0;
+	context.stats.frame_meshes_culled = 0;
+	context.stats.frame_meshes_lod = 0;
+	context.stats.frame_meshlets = 0;
+	context.stats.frame_meshlets_culled = 0;
+	context.stats.frame_transform_hits = 0;
+	context.stats.frame_transform_misses = 0;
+	context.stats.frame_vertices = 0;
+	context.stats.frame_meshes_queued = 0;
+	context.depth_pyramid.source = nullptr;
+	context.queue_count = 0;
+	context.frame++;
+	if (context.target != nullptr)
+	{
+		FramebufferClear(context.target);
+		return;
+	}
+	if (context.mode != RENDER_MODE_DEPTH) return;
+
+	Framebuffer& fb = context.framebuffer;
+	if (fb.width != APP_VIRTUAL_WIDTH || fb.height != APP_VIRTUAL_HEIGHT)
+	{
+		FramebufferCreate(&fb, APP_VIRTUAL_WIDTH, APP_VIRTUAL_HEIGHT);
+		context.stats.frame_allocations++;
+		context.stats.total_allocations++;
+	}
+	else
+	{
+		FramebufferClear(&fb);
+	}
+}
+
+static void FlushTriangles()
+{
+	TriangleStream& stream = context.triangles;
+	if (stream.count == 0) return;
+
+	App::DrawTriangles(stream.xy.data, stream.rgb.data, (int)stream.count, stream.wireframe);
+	context.stats.frame_draw_calls++;
+	stream.count = 0;
+}
+
+void DrawEnd()
+{
+	FlushQueue();
+
+	// Render targets are left for the caller to read
+	if (context.target != nullptr) return;
+
+	if (context.mode != RENDER_MODE_DEPTH)
+	{
+		FlushTriangles();
+		return;
+	}
+
+	Framebuffer& fb = context.framebuffer;
+	App::DrawPixels(fb.width, fb.height, fb.color.data());
+	context.stats.frame_draw_calls++;
+}
+
+// Coherent sorting gives up on repairing last frame's order if more than 1 in COHERENT_MAX_DESCENT_RATIO neighbouring faces
+// are out of order, or once insertion sort has shifted faces more than COHERENT_MAX_MOVES_PER_FACE places on average
+static constexpr size_t COHERENT_MAX_DESCENT_RATIO = 8;
+static constexpr size_t COHERENT_MAX_MOVES_PER_FACE = 8;
+static constexpr uint32_t SLOT_NONE = ~0u;
+
+static SortHistory* FindSortHistory(const void* owner)
+{
+	SortHistory* lru = &context.sort_history[0];
+	for (SortHistory& history : context.sort_history)
+	{
+		if (history.owner == owner)
+			return &history;
+		if (history.last_frame < lru->last_frame)
+			lru = &history;
+	}
+
+	lru->owner = owner;
+	lru->mesh_face_count = 0;
+	lru->face_count = 0;
+	return lru;
+}
+
+// Sorts keys starting from owner's order last frame. Camera and objects move little between frames,
+// so that order is usually only a few swaps away from correct and insertion sort repairs it in near-linear time.
+// Keys index the visible faces, which change from frame to frame, so history is recorded as face numbers (see MeshBatch).
+// number_count is how many face numbers there are, the mesh's face count times its instances.
+// owner is the mesh being drawn, or the draw queue when its faces are sorted together
+static const SortKey* SortCoherent(const void* owner, size_t number_count, const uint32_t* face_indices, SortKey* keys, size_t count)
+{
+	SortHistory* history = FindSortHistory(owner);
+	history->last_frame = context.frame;
+
+	SortKey* temp = context.sort_temp.data;
+	SortKey* sorted = nullptr;
+	if (history->mesh_face_count == number_count)
+	{
+		// Map each face number to its first key this frame, then walk last frame's order picking up faces that are still visible.
+		// A face split by near-plane clipping has several keys, always next to each other
+		RenderReserve(&context, &context.face_slots, number_count);
+		uint32_t* slots = context.face_slots.data;
+		std::fill(slots, slots + number_count, SLOT_NONE);
+		for (size_t i = count; i-- > 0;)
+			slots[face_indices[i]] = (uint32_t)i;
+
+		size_t n = 0;
+		for (size_t i = 0; i < history->face_count; i++)
+		{
+			uint32_t f = history->order[i];
+			uint32_t slot = slots[f];
+			if (slot == SLOT_NONE) continue;
+			for (size_t j = slot; j < count && face_indices[j] == f; j++)
+				temp[n++] = keys[j];
+			slots[f] = SLOT_NONE;
+		}
+
+		// Faces that weren't visible last frame go at the end for insertion sort to place
+		for (size_t i = 0; i < count; i++)
+		{
+			if (slots[face_indices[i]] != SLOT_NONE)
+				temp[n++] = keys[i];
+		}
+
+		if (SortCountDescents(temp, count) <= count / COHERENT_MAX_DESCENT_RATIO &&
+			SortInsertion(temp, count, count * COHERENT_MAX_MOVES_PER_FACE))
+		{
+			sorted = temp;
+			context.stats.sorts_repaired++;
+		}
+		else
+		{
+			// keys were already gathered into temp so they're free to be used as scratch
+			sorted = SortRadix(temp, keys, count);
+			context.stats.sorts_full++;
+		}
+	}
+	else
+	{
+		sorted = SortRadix(keys, temp, count);
+		context.stats.sorts_full++;
+	}
+
+	// Only grown once last frame's order has been read, since workspaces don't keep their contents
+	RenderReserve(&context, &history->order, count);
+	for (size_t i = 0; i < count; i++)
+		history->order[i] = face_indices[sorted[i].index];
+	history->face_count = count;
+	history->mesh_face_count = number_count;
+
+	return sorted;
+}
+
+// The CPU framebuffer this frame is being drawn into, if there is one
+static Framebuffer* DrawFramebuffer()
+{
+	if (context.target != nullptr) return context.target;
+	return context.mode == RENDER_MODE_DEPTH ? &context.framebuffer : nullptr;
+}
+
+void DrawBuildOcclusion()
+{
+	FlushQueue();
+
+	DepthPyramid& pyramid = context.depth_pyramid;
+	pyramid.source = nullptr;
+	Framebuffer* fb = DrawFramebuffer();
+	if (fb == nullptr || fb->width == 0 || fb->height == 0) return;
+
+	// Each level halves the one below (rounding up) until a single texel is left
+	int width = (fb->width + DEPTH_PYRAMID_BLOCK_SIZE - 1) / DEPTH_PYRAMID_BLOCK_SIZE;
+	int height = (fb->height + DEPTH_PYRAMID_BLOCK_SIZE - 1) / DEPTH_PYRAMID_BLOCK_SIZE;
+	size_t size = 0;
+	pyramid.levels = 0;
+	while (pyramid.levels < DEPTH_PYRAMID_MAX_LEVELS)
+	{
+		int level = pyramid.levels++;
+		pyramid.width[level] = width;
+		pyramid.height[level] = height;
+		pyramid.offset[level] = size;
+		size += width * height;
+		if (width == 1 && height == 1) break;
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+	}
+	RenderReserve(&context, &pyramid.depth, size);
+
+	// Level 0 reads the whole depth buffer, so its rows are split between threads
+	float* level0 = pyramid.depth.data;
+	auto downsample = [&](size_t begin, size_t end, int /*worker*/)
+	{
+		for (size_t ty = begin; ty < end; ty++)
+		{
+			int y_min = (int)ty * DEPTH_PYRAMID_BLOCK_SIZE;
+			int y_max = std::min(y_min + DEPTH_PYRAMID_BLOCK_SIZE, fb->height);
+			for (int tx = 0; tx < pyramid.width[0]; tx++)
+			{
+				int x_min = tx * DEPTH_PYRAMID_BLOCK_SIZE;
+				int x_max = std::min(x_min + DEPTH_PYRAMID_BLOCK_SIZE, fb->width);
+				float farthest = -INFINITY;
+				for (int y = y_min; y < y_max; y++)
+					for (int x = x_min; x < x_max; x++)
+						farthest = fmaxf(farthest, fb->depth[y * fb->width + x]);
+				level0[ty * pyramid.width[0] + tx] = farthest;
+			}
+		}
+	};
+	JobsParallelFor(pyramid.height[0], 4, downsample);
+
+	for (int level = 1; level < pyramid.levels; level++)
+	{
+		const float* below = pyramid.depth.data + pyramid.offset[level - 1];
+		float* above = pyramid.depth.data + pyramid.offset[level];
+		int below_width = pyramid.width[level - 1];
+		int below_height = pyramid.height[level - 1];
+		for (int y = 0; y < pyramid.height[level]; y++)
+		{
+			for (int x = 0; x < pyramid.width[level]; x++)
+			{
+				float farthest = -INFINITY;
+				for (int j = y * 2; j < std::min(y * 2 + 2, below_height); j++)
+					for (int i = x * 2; i < std::min(x * 2 + 2, below_width); i++)
+						farthest = fmaxf(farthest, below[j * below_width + i]);
+				above[y * pyramid.width[level] + x] = farthest;
+			}
+		}
+	}
+
+	pyramid.source = fb;
+}
+
+// Tests the mesh's bounding box against the frustum, then against the depth pyramid if there is one.
+// Returns true if no part of the mesh can be visible
+static bool CullMesh(const Mesh& mesh, const Matrix& mvp)
+{
+	Vector3 lo = mesh.bounds_min;
+	Vector3 hi = mesh.bounds_max;
+	if (!(lo.x <= hi.x && lo.y <= hi.y && lo.z <= hi.z)) return false;
+
+	uint32_t all_outside = ~0u;
+	uint32_t any_outside = 0;
+	Vector3 ndc_min = { INFINITY, INFINITY, INFINITY };
+	Vector3 ndc_max = { -INFINITY, -INFINITY, -INFINITY };
+	for (int i = 0; i < 8; i++)
+	{
+		Vector4 corner = { i & 1 ? hi.x : lo.x, i & 2 ? hi.y : lo.y, i & 4 ? hi.z : lo.z, 1.0f };
+		Vector4 clip = corner * mvp;
+		Vector3 ndc = { clip.x / clip.w, clip.y / clip.w, clip.z / clip.w };
+		uint32_t code = ClipOutcode(ndc.x, ndc.y, ndc.z, clip.w);
+		all_outside &= code;
+		any_outside |= code;
+		ndc_min = Vector3Min(ndc_min, ndc);
+		ndc_max = Vector3Max(ndc_max, ndc);
+	}
+
+	// Every corner is outside the same plane
+	if (all_outside != 0) return true;
+
+	// Boxes crossing the near plane have no meaningful screen-space bounds, and are too close to be hidden anyway
+	const DepthPyramid& pyramid = context.depth_pyramid;
+	if (pyramid.source == nullptr || pyramid.source != DrawFramebuffer() || (any_outside & CLIP_NEAR)) return false;
+
+	// Texels of level 0 under the box's screen-space bounds, then the level where those fit in 2x2 texels
+	const Framebuffer& fb = *pyramid.source;
+	float texel_scale = 1.0f / DEPTH_PYRAMID_BLOCK_SIZE;
+	int x_min = (int)Clamp(floorf((ndc_min.x * 0.5f + 0.5f) * fb.width * texel_scale), 0.0f, pyramid.width[0] - 1.0f);
+	int y_min = (int)Clamp(floorf((ndc_min.y * 0.5f + 0.5f) * fb.height * texel_scale), 0.0f, pyramid.height[0] - 1.0f);
+	int x_max = (int)Clamp(floorf((ndc_max.x * 0.5f + 0.5f) * fb.width * texel_scale), 0.0f, pyramid.width[0] - 1.0f);
+	int y_max = (int)Clamp(floorf((ndc_max.y * 0.5f + 0.5f) * fb.height * texel_scale), 0.0f, pyramid.height[0] - 1.0f);
+	int level = 0;
+	while ((x_max - x_min > 1 || y_max - y_min > 1) && level + 1 < pyramid.levels)
+	{
+		x_min >>= 1;
+		y_min >>= 1;
+		x_max >>= 1;
+		y_max >>= 1;
+		level++;
+	}
+
+	const float* depth = pyramid.depth.data + pyramid.offset[level];
+	float farthest = -INFINITY;
+	for (int y = y_min; y <= y_max; y++)
+		for (int x = x_min; x <= x_max; x++)
+			farthest = fmaxf(farthest, depth[y * pyramid.width[level] + x]);
+
+	// The nearest point of the box is behind everything already drawn there
+	return ndc_min.z > farthest;
+}
+
+static void MeshletCullerInit(MeshletCuller* culler, Vector3 camera_position, const Matrix& world, const Matrix& mvp)
+{
+	// Clip-space x, y and z each lie in [-w, w], so every frustum plane is the w row of mvp plus or minus another row
+	const Matrix& m = mvp;
+	Vector4 rows[4] = {
+		{ m.m0, m.m4, m.m8, m.m12 },
+		{ m.m1, m.m5, m.m9, m.m13 },
+		{ m.m2, m.m6, m.m10, m.m14 },
+		{ m.m3, m.m7, m.m11, m.m15 } };
+	for (int i = 0; i < 3; i++)
+	{
+		culler->planes[i * 2 + 0] = rows[3] + rows[i];
+		culler->planes[i * 2 + 1] = rows[3] - rows[i];
+	}
+	for (Vector4& plane : culler->planes)
+		plane = plane / Vector3Length({ plane.x, plane.y, plane.z });
+
+	culler->camera = camera_position * MatrixInvert(world);
+	culler->cones = MatrixDeterminant(world) > 0.0f;
+}
+
+// True if no face of the meshlet can be visible -- its bounding sphere is outside a frustum plane,
+// or the camera is behind every face (Barequet & Elber's normal cone test, with the sphere standing in for the cone's apex)
+static bool CullMeshlet(const Meshlet& meshlet, const MeshletCuller& culler)
+{
+	for (const Vector4& plane : culler.planes)
+	{
+		if (plane.x * meshlet.center.x + plane.y * meshlet.center.y + plane.z * meshlet.center.z + plane.w < -meshlet.radius)
+			return true;
+	}
+
+	Vector3 view = meshlet.center - culler.camera;
+	return culler.cones && Vector3DotProduct(view, meshlet.cone_axis) >= meshlet.cone_cutoff * Vector3Length(view) + meshlet.radius;
+}
+
+// Pixels per local-space unit, from how far a small step along each local axis moves a point on screen.
+// Measured at the box's corners and center and the largest kept, so the mesh's nearest part and any edge-on axis are covered.
+// INFINITY if part of the box is at or behind the camera
+static float PixelsPerUnit(const Mesh& mesh, const Matrix& mvp)
+{
+	Vector3 lo = mesh.bounds_min;
+	Vector3 hi = mesh.bounds_max;
+	const Framebuffer* fb = DrawFramebuffer();
+	float half_width = (fb != nullptr ? fb->width : APP_VIRTUAL_WIDTH) * 0.5f;
+	float half_height = (fb != nullptr ? fb->height : APP_VIRTUAL_HEIGHT) * 0.5f;
+	float step = fmaxf(Vector3Distance(lo, hi) * 1e-3f, 1e-6f);
+	float pixels_per_unit = 0.0f;
+	for (int i = 0; i < 9; i++)
+	{
+		Vector3 p = i < 8 ? Vector3{ i & 1 ? hi.x : lo.x, i & 2 ? hi.y : lo.y, i & 4 ? hi.z : lo.z } : (lo + hi) * 0.5f;
+		Vector4 c = Vector4{ p.x, p.y, p.z, 1.0f } * mvp;
+		if (!(c.w > 0.0f)) return INFINITY;
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			Vector3 q = p;
+			(&q.x)[axis] += step;
+			Vector4 o = Vector4{ q.x, q.y, q.z, 1.0f } * mvp;
+			if (!(o.w > 0.0f)) return INFINITY;
+
+			float dx = (o.x / o.w - c.x / c.w) * half_width;
+			float dy = (o.y / o.w - c.y / c.w) * half_height;
+			pixels_per_unit = fmaxf(pixels_per_unit, sqrtf(dx * dx + dy * dy) / step);
+		}
+	}
+	return pixels_per_unit;
+}
+
+// The cache holding mesh's vertices transformed by world and mvp, or the one to transform them into if there isn't one.
+// A miss takes over an entry of the same mesh not yet used this frame (so a moving mesh keeps reusing its own), or else the least recently used
+static TransformCache* FindTransformCache(const Mesh& mesh, const Matrix& world, const Matrix& mvp, size_t padded_count)
+{
+	TransformCache* lru = &context.transform_cache[0];
+	TransformCache* same_mesh = nullptr;
+	for (TransformCache& cache : context.transform_cache)
+	{
+		if (cache.mesh == &mesh && cache.generation == mesh.generation &&
+			memcmp(&cache.world, &world, sizeof(Matrix)) == 0 && memcmp(&cache.mvp, &mvp, sizeof(Matrix)) == 0)
+		{
+			cache.last_frame = context.frame;
+			context.stats.frame_transform_hits++;
+			return &cache;
+		}
+		if (cache.mesh == &mesh && cache.last_frame != context.frame)
+			same_mesh = &cache;
+		if (cache.last_frame < lru->last_frame)
+			lru = &cache;
+	}
+
+	TransformCache* cache = same_mesh != nullptr ? same_mesh : lru;
+	cache->mesh = &mesh;
+	cache->generation = mesh.generation;
+	cache->world = world;
+	cache->mvp = mvp;
+	cache->last_frame = context.frame;
+	context.stats.frame_transform_misses++;
+
+	size_t block_count = (std::max(mesh.face_count, mesh.vertex_count) + MESH_MESHLET_FACES - 1) / MESH_MESHLET_FACES;
+	RenderReserve(&context, &cache->world_x, padded_count);
+	RenderReserve(&context, &cache->world_y, padded_count);
+	RenderReserve(&context, &cache->world_z, padded_count);
+	RenderReserve(&context, &cache->clip_x, padded_count);
+	RenderReserve(&context, &cache->clip_y, padded_count);
+	RenderReserve(&context, &cache->clip_z, padded_count);
+	RenderReserve(&context, &cache->clip_w, padded_count);
+	RenderReserve(&context, &cache->valid, block_count);
+	std::fill(cache->valid.data, cache->valid.data + block_count, 0);
+	return cache;
+}
+
+// The LOD to draw mesh with at mvp: 0 for mesh itself, i + 1 for mesh.lods[i]
+static int SelectLodLevel(const Mesh& mesh, const Matrix& mvp)
+{
+	Vector3 lo = mesh.bounds_min;
+	Vector3 hi = mesh.bounds_max;
+	if (mesh.lods.empty() || !(lo.x <= hi.x && lo.y <= hi.y && lo.z <= hi.z)) return 0;
+
+	float pixels_per_unit = PixelsPerUnit(mesh, mvp);
+	if (pixels_per_unit == INFINITY) return 0;
+
+	// Errors grow with each LOD, so the last one under the limit is the coarsest
+	int level = 0;
+	while (level < (int)mesh.lods.size() && mesh.lods[level].lod_error * pixels_per_unit <= DRAW_LOD_MAX_ERROR)
+		level++;
+	return level;
+}
+
+const Mesh& DrawSelectLod(const Mesh& mesh, const Matrix& mvp)
+{
+	// Culled draws skip measuring, DrawMeshPrepare culls them either way
+	if (mesh.lods.empty() || CullMesh(mesh, mvp)) return mesh;
+	int level = SelectLodLevel(mesh, mvp);
+	if (level == 0) return mesh;
+
+	// Only counted if DrawMeshPrepare won't cull it, tested against the LOD's own bounds as it will be
+	const Mesh& lod = mesh.lods[level - 1];
+	context.stats.frame_meshes_lod += !CullMesh(lod, mvp);
+	return lod;
+}
+
+size_t DrawGroupInstances(const Mesh& mesh, const Matrix& mvp, const Matrix* instances, size_t instance_count, DrawLodGroup* groups)
+{
+	// Each instance's level, or -1 if its bounds (or its LOD's) are culled
+	RenderReserve(&context, &context.lod_levels, instance_count);
+	int8_t* levels = context.lod_levels.data;
+	auto select = [&](size_t begin, size_t end, int /*worker*/)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			Matrix instance_mvp = instances[i] * mvp;
+			int level = CullMesh(mesh, instance_mvp) ? -1 : SelectLodLevel(mesh, instance_mvp);
+			if (level > 0 && CullMesh(mesh.lods[level - 1], instance_mvp))
+				level = -1;
+			levels[i] = (int8_t)level;
+		}
+	};
+	JobsParallelFor(instance_count, DRAW_INSTANCE_CHUNK_SIZE, select);
+
+	// Culled instances are dropped here, but still counted as drawn and culled like DrawMeshPrepare would have
+	size_t level_counts[DRAW_MAX_LOD_GROUPS] = {};
+	size_t culled = 0;
+	for (size_t i = 0; i < instance_count; i++)
+	{
+		if (levels[i] < 0)
+			culled++;
+		else
+			level_counts[levels[i]]++;
+	}
+	context.stats.frame_meshes += culled;
+	context.stats.frame_meshes_culled += culled;
+
+	// Coarsest first, so in painter's modes the farther groups are drawn under the nearer ones
+	RenderReserve(&context, &context.lod_instances, instance_count - culled);
+	Matrix* grouped = context.lod_instances.data;
+	size_t cursors[DRAW_MAX_LOD_GROUPS];
+	size_t group_count = 0;
+	size_t offset = 0;
+	for (int level = (int)mesh.lods.size(); level >= 0; level--)
+	{
+		if (level_counts[level] == 0) continue;
+		cursors[level] = offset;
+		groups[group_count++] = { level > 0 ? &mesh.lods[level - 1] : &mesh, grouped + offset, level_counts[level] };
+		offset += level_counts[level];
+		if (level > 0)
+			context.stats.frame_meshes_lod += level_counts[level];
+	}
+	for (size_t i = 0; i < instance_count; i++)
+	{
+		if (levels[i] >= 0)
+			grouped[cursors[levels[i]]++] = instances[i];
+	}
+	return group_count;
+}
+
+// DrawMeshPrepare, appending the batch's faces (and their face numbers, colors and sort keys) after the first first_face,
+// which are kept. The draw queue prepares its meshes one after another this way so their faces can be sorted together
+static bool PrepareMesh(const Mesh& mesh, const UniformData& data, MeshBatch* batch, const Matrix* instances, size_t instance_count, size_t first_face)
 {
-	Matrix normal_matrix = MatrixNormal(data.world);
+	size_t mesh_face_count = mesh.face_count;
+	assert(instance_count <= DrawMaxInstances(mesh) && "Face numbers are 32-bit, DrawMeshInstanced splits larger draws");
+	bool meshlets = mesh.meshlets.size() == (mesh_face_count + MESH_MESHLET_FACES - 1) / MESH_MESHLET_FACES;
+	RenderReserve(&context, &context.instance_world, instance_count);
+	RenderReserve(&context, &context.instance_mvp, instance_count);
+	RenderReserve(&context, &context.instance_normal, instance_count);
+	RenderReserve(&context, &context.instance_culled, instance_count);
+	if (meshlets)
+		RenderReserve(&context, &context.instance_cullers, instance_count);
+	Matrix* instance_world = context.instance_world.data;
+	Matrix* instance_mvp = context.instance_mvp.data;
+	Matrix* instance_normal = context.instance_normal.data;
+	uint8_t* instance_culled = context.instance_culled.data;
+	MeshletCuller* instance_cullers = context.instance_cullers.data;
 
-	std::vector<Face> faces;
-	faces.resize(mesh.face_count);
-	for (size_t f = 0; f < mesh.face_count; f++)
+	// Stage 0 -- each instance's matrices, and whether its bounds can be visible at all
+	std::atomic<size_t> instances_culled{ 0 };
+	auto setup = [&](size_t begin, size_t end, int /*worker*/)
 	{
-		size_t v = f * 3;
-		for (size_t i = 0; i < 3; i++)
+		size_t culled = 0;
+		for (size_t i = begin; i < end; i++)
 		{
-			Vector3 position_local = mesh.positions[v + i];
-			faces[f].positions_world[i] = position_local * data.world;
-			faces[f].positions_clip[i] = MatrixPerspectiveDivide(data.mvp, position_local);
+			instance_world[i] = instances != nullptr ? instances[i] * data.world : data.world;
+			instance_mvp[i] = instances != nullptr ? instances[i] * data.mvp : data.mvp;
+			instance_culled[i] = CullMesh(mesh, instance_mvp[i]);
+			if (instance_culled[i])
+			{
+				culled++;
+				continue;
+			}
+
+			instance_normal[i] = MatrixNormal(instance_world[i]);
+			if (meshlets)
+				MeshletCullerInit(&instance_cullers[i], data.camera_position, instance_world[i], instance_mvp[i]);
 		}
-		faces[f].normal_world = Vector3Normalize(mesh.normals[f] * normal_matrix);
+		instances_culled += culled;
+	};
+	JobsParallelFor(instance_count, DRAW_INSTANCE_CHUNK_SIZE, setup);
+
+	size_t visible_instances = instance_count - instances_culled;
+	context.stats.frame_meshes += instance_count;
+	context.stats.frame_meshes_culled += instances_culled;
+	if (visible_instances == 0) return false;
+
+	// Instances are laid out one after another, face number n's vertices are always at n * 3.
+	// Indexed meshes transform each instance's vertices once instead, every instance starting on a SIMD boundary (see DrawFaceVertices)
+	bool indexed = mesh.vertex_count > 0;
+	bool quantized = !mesh.quantized_x.empty();
+	size_t vertex_stride = indexed ? (quantized ? mesh.quantized_x.size() : mesh.vertex_x.size()) : 0;
+	size_t face_count = mesh_face_count * instance_count;
+	size_t vertex_count = face_count * 3;
+	size_t padded_count = indexed ? vertex_stride * instance_count : (vertex_count + TRANSFORM_SIMD_WIDTH - 1) / TRANSFORM_SIMD_WIDTH * TRANSFORM_SIMD_WIDTH;
+	size_t mesh_padded_count = (mesh_face_count * 3 + TRANSFORM_SIMD_WIDTH - 1) / TRANSFORM_SIMD_WIDTH * TRANSFORM_SIMD_WIDTH;
+	size_t chunk_count = (face_count + DRAW_CHUNK_SIZE - 1) / DRAW_CHUNK_SIZE;
+	RenderReserve(&context, &context.visible, face_count);
+	RenderReserve(&context, &context.near, face_count);
+	RenderReserve(&context, &context.chunk_visible_counts, chunk_count);
+	RenderReserve(&context, &context.chunk_near_counts, chunk_count);
+
+	// Single draws are transformed into their mesh's cache, instances (which would need every instance's matrices compared) into the context
+	TransformCache* cache = instances == nullptr ? FindTransformCache(mesh, data.world, data.mvp, padded_count) : nullptr;
+	Float3Stream world;
+	ClipStream clip;
+	if (cache != nullptr)
+	{
+		world = { cache->world_x.data, cache->world_y.data, cache->world_z.data };
+		clip = { cache->clip_x.data, cache->clip_y.data, cache->clip_z.data, cache->clip_w.data };
 	}
+	else
+	{
+		RenderReserve(&context, &context.world_x, padded_count);
+		RenderReserve(&context, &context.world_y, padded_count);
+		RenderReserve(&context, &context.world_z, padded_count);
+		RenderReserve(&context, &context.clip_x, padded_count);
+		RenderReserve(&context, &context.clip_y, padded_count);
+		RenderReserve(&context, &context.clip_z, padded_count);
+		RenderReserve(&context, &context.clip_w, padded_count);
+		world = { context.world_x.data, context.world_y.data, context.world_z.data };
+		clip = { context.clip_x.data, context.clip_y.data, context.clip_z.data, context.clip_w.data };
+	}
+	uint8_t* valid = cache != nullptr ? cache->valid.data : nullptr;
+	uint32_t* visible = context.visible.data;
+	uint32_t* near = context.near.data;
+	uint32_t* chunk_visible_counts = context.chunk_visible_counts.data;
+	uint32_t* chunk_near_counts = context.chunk_near_counts.data;
+
+	batch->mesh_face_count = mesh_face_count;
+	batch->instance_count = instance_count;
+	batch->indices_16 = indexed && !mesh.indices_16.empty() ? mesh.indices_16.data() : nullptr;
+	batch->indices_32 = indexed && !mesh.indices_32.empty() ? mesh.indices_32.data() : nullptr;
+	batch->vertex_stride = vertex_stride;
+	batch->normals_oct_8 = quantized && !mesh.normals_oct_8.empty() ? mesh.normals_oct_8.data() : nullptr;
+	batch->normals_oct_16 = quantized && !mesh.normals_oct_16.empty() ? mesh.normals_oct_16.data() : nullptr;
 
-	auto pr = [](const Face& a, const Face& b)
+	TransformKernel transform = TransformGetKernel();
+	QuantizedTransformKernel transform_quantized = TransformGetQuantizedKernel();
+	bool soa = mesh.soa_x.size() == mesh_padded_count;
+	std::atomic<size_t> meshlets_culled{ 0 };
+	std::atomic<size_t> vertices_transformed{ 0 };
+
+	// Stage 1a (indexed meshes only) -- every vertex of every visible instance is transformed once, however many faces share it.
+	// Instances start on a SIMD boundary and are padded to one, so every run goes through the kernel whole
+	auto transform_vertices = [&](size_t begin, size_t end, int /*worker*/)
 	{
-		float avg_depth_a = (a.positions_clip[0].z + a.positions_clip[1].z + a.positions_clip[2].z) / 3.0f;
-		float avg_depth_b = (b.positions_clip[0].z + b.positions_clip[1].z + b.positions_clip[2].z) / 3.0f;
-		return avg_depth_a > avg_depth_b;
+		size_t transformed = 0;
+		for (size_t first = begin, last; first < end; first = last)
+		{
+			size_t instance = first / vertex_stride;
+			size_t mesh_first = first - instance * vertex_stride;
+			last = std::min(end, (instance + 1) * vertex_stride);
+			if (instance_culled[instance]) continue;
+
+			// Blocks of MESH_MESHLET_FACES vertices already transformed by an earlier draw with the same matrices are skipped
+			bool cached = valid != nullptr;
+			if (valid != nullptr)
+			{
+				for (size_t b = first / MESH_MESHLET_FACES; b < (last + MESH_MESHLET_FACES - 1) / MESH_MESHLET_FACES; b++)
+				{
+					cached &= valid[b] != 0;
+					valid[b] = 1;
+				}
+			}
+			if (cached) continue;
+
+			Float3Stream world_range = { world.x + first, world.y + first, world.z + first };
+			ClipStream clip_range = { clip.x + first, clip.y + first, clip.z + first, clip.w + first };
+			if (quantized)
+			{
+				// Dequantizing is folded into the matrices, so the kernel only has to widen the positions
+				ConstQuantizedStream local = { mesh.quantized_x.data() + mesh_first, mesh.quantized_y.data() + mesh_first, mesh.quantized_z.data() + mesh_first };
+				transform_quantized(local, last - first, mesh.dequantize * instance_world[instance], mesh.dequantize * instance_mvp[instance], world_range, clip_range);
+			}
+			else
+			{
+				ConstFloat3Stream local = { mesh.vertex_x.data() + mesh_first, mesh.vertex_y.data() + mesh_first, mesh.vertex_z.data() + mesh_first };
+				transform(local, last - first, instance_world[instance], instance_mvp[instance], world_range, clip_range);
+			}
+			transformed += last - first;
+		}
+		vertices_transformed += transformed;
 	};
+	if (indexed)
+		JobsParallelFor(padded_count, DRAW_CHUNK_SIZE, transform_vertices);
+
+	// Stage 1 -- transform, clip and cull. Every face is independent so chunks of faces run on all threads.
+	// A chunk is split into runs of faces that share an instance (and meshlet), and runs in culled instances or meshlets are skipped
+	auto transform_cull = [&](size_t begin, size_t end, int /*worker*/)
+	{
+		// Survivors are compacted into the chunk's own slice of visible (or near, if they need clipping)
+		uint32_t* chunk_visible = visible + begin;
+		uint32_t* chunk_near = near + begin;
+		uint32_t n = 0;
+		uint32_t m = 0;
+		size_t culled = 0;
+		size_t transformed = 0;
+		for (size_t first = begin, last; first < end; first = last)
+		{
+			size_t instance = first / mesh_face_count;
+			size_t mesh_first = first - instance * mesh_face_count;
+			size_t mesh_last = std::min(mesh_face_count, mesh_first + (end - first));
+			if (instance_culled[instance])
+			{
+				last = first + (mesh_last - mesh_first);
+				continue;
+			}
+
+			if (meshlets)
+			{
+				size_t meshlet = mesh_first / MESH_MESHLET_FACES;
+				mesh_last = std::min(mesh_last, (meshlet + 1) * MESH_MESHLET_FACES);
+				last = first + (mesh_last - mesh_first);
+				if (CullMeshlet(mesh.meshlets[meshlet], instance_cullers[instance]))
+				{
+					// Meshlets split between chunks are only counted by the chunk with their first face
+					culled += mesh_first % MESH_MESHLET_FACES == 0;
+					continue;
+				}
+			}
+			last = first + (mesh_last - mesh_first);
+
+			const Matrix& world_matrix = instance_world[instance];
+			const Matrix& mvp = instance_mvp[instance];
+			size_t v_begin = first * 3;
+			size_t v_count = (last - first) * 3;
+			size_t mesh_v_begin = mesh_first * 3;
+			Float3Stream world_range = { world.x + v_begin, world.y + v_begin, world.z + v_begin };
+			ClipStream clip_range = { clip.x + v_begin, clip.y + v_begin, clip.z + v_begin, clip.w + v_begin };
+
+			// Skip runs whose blocks were all transformed by an earlier draw with the same matrices (or by stage 1a).
+			// Without instances, runs always cover whole blocks
+			bool cached = valid != nullptr || indexed;
+			if (valid != nullptr && !indexed)
+			{
+				for (size_t b = first / MESH_MESHLET_FACES; b < (last + MESH_MESHLET_FACES - 1) / MESH_MESHLET_FACES; b++)
+				{
+					cached &= valid[b] != 0;
+					valid[b] = 1;
+				}
+			}
+
+			if (soa && !cached)
+			{
+				// Runs that start on a SIMD boundary and end the whole batch also transform the padding, so kernels never need a scalar tail.
+				// Instances after the first can start and end anywhere, so their leftover vertices are transformed one at a time
+				size_t simd_count = v_count / TRANSFORM_SIMD_WIDTH * TRANSFORM_SIMD_WIDTH;
+				if (last == face_count && v_begin % TRANSFORM_SIMD_WIDTH == 0 && mesh_v_begin % TRANSFORM_SIMD_WIDTH == 0)
+					simd_count = mesh_padded_count - mesh_v_begin;
+
+				ConstFloat3Stream local = { mesh.soa_x.data() + mesh_v_begin, mesh.soa_y.data() + mesh_v_begin, mesh.soa_z.data() + mesh_v_begin };
+				transform(local, simd_count, world_matrix, mvp, world_range, clip_range);
+				transformed += std::max(simd_count, v_count);
+				if (simd_count < v_count)
+				{
+					ConstFloat3Stream tail = { local.x + simd_count, local.y + simd_count, local.z + simd_count };
+					Float3Stream world_tail = { world_range.x + simd_count, world_range.y + simd_count, world_range.z + simd_count };
+					ClipStream clip_tail = { clip_range.x + simd_count, clip_range.y + simd_count, clip_range.z + simd_count, clip_range.w + simd_count };
+					TransformPositionsScalar(tail, v_count - simd_count, world_matrix, mvp, world_tail, clip_tail);
+				}
+			}
+			else if (!cached)
+			{
+				for (size_t v = 0; v < v_count; v++)
+				{
+					Vector3 position_local = mesh.positions[mesh_v_begin + v];
+					ConstFloat3Stream local = { &position_local.x, &position_local.y, &position_local.z };
+					Float3Stream world_vertex = { world_range.x + v, world_range.y + v, world_range.z + v };
+					ClipStream clip_vertex = { clip_range.x + v, clip_range.y + v, clip_range.z + v, clip_range.w + v };
+					TransformPositionsScalar(local, 1, world_matrix, mvp, world_vertex, clip_vertex);
+				}
+				transformed += v_count;
+			}
+
+			// DrawFaceVertices, with the instance already known
+			const uint16_t* corners_16 = batch->indices_16 != nullptr ? batch->indices_16 + mesh_first * 3 : nullptr;
+			const uint32_t* corners_32 = batch->indices_32 != nullptr ? batch->indices_32 + mesh_first * 3 : nullptr;
+			size_t first_vertex = instance * vertex_stride;
+			for (size_t f = first; f < last; f++)
+			{
+				size_t v[3];
+				for (size_t j = 0; j < 3; j++)
+				{
+					size_t corner = (f - first) * 3 + j;
+					v[j] = !indexed ? f * 3 + j : first_vertex + (corners_16 != nullptr ? corners_16[corner] : corners_32[corner]);
+				}
+				uint32_t c0 = ClipOutcode(clip.x[v[0]], clip.y[v[0]], clip.z[v[0]], clip.w[v[0]]);
+				uint32_t c1 = ClipOutcode(clip.x[v[1]], clip.y[v[1]], clip.z[v[1]], clip.w[v[1]]);
+				uint32_t c2 = ClipOutcode(clip.x[v[2]], clip.y[v[2]], clip.z[v[2]], clip.w[v[2]]);
+
+				// Frustum rejection -- every vertex is outside the same plane (including faces entirely behind the camera)
+				if (c0 & c1 & c2) continue;
+
+				// Crosses the near plane, so the divided positions are meaningless. These are rare and clipped after the parallel stages
+				if ((c0 | c1 | c2) & CLIP_NEAR)
+				{
+					chunk_near[m++] = (uint32_t)f;
+					continue;
+				}
+
+				// Backface culling -- the sign of the screen-space signed area gives the winding, counter-clockwise faces face the camera.
+				// Degenerate and NaN faces fail the test too
+				float area =
+					(clip.x[v[1]] - clip.x[v[0]]) * (clip.y[v[2]] - clip.y[v[0]]) -
+					(clip.x[v[2]] - clip.x[v[0]]) * (clip.y[v[1]] - clip.y[v[0]]);
+				chunk_visible[n] = (uint32_t)f;
+				n += area > 0.0f;
+			}
+		}
+		chunk_visible_counts[begin / DRAW_CHUNK_SIZE] = n;
+		chunk_near_counts[begin / DRAW_CHUNK_SIZE] = m;
+		meshlets_culled += culled;
+		vertices_transformed += transformed;
+	};
+	JobsParallelFor(face_count, DRAW_CHUNK_SIZE, transform_cull);
+	if (meshlets)
+	{
+		context.stats.frame_meshlets += mesh.meshlets.size() * visible_instances;
+		context.stats.frame_meshlets_culled += meshlets_culled;
+	}
+	context.stats.frame_vertices += vertices_transformed;
+
+	// Close the gaps between chunks so later stages only see dense lists of faces
+	size_t visible_count = 0;
+	size_t near_count = 0;
+	for (size_t c = 0; c < chunk_count; c++)
+	{
+		memmove(visible + visible_count, visible + c * DRAW_CHUNK_SIZE, chunk_visible_counts[c] * sizeof(uint32_t));
+		memmove(near + near_count, near + c * DRAW_CHUNK_SIZE, chunk_near_counts[c] * sizeof(uint32_t));
+		visible_count += chunk_visible_counts[c];
+		near_count += chunk_near_counts[c];
+	}
+
+	// Clipping splits a face into at most 2 triangles
+	size_t max_face_count = visible_count + near_count * 2;
+	bool painter = context.mode != RENDER_MODE_DEPTH;
+	size_t end_face_count = first_face + max_face_count;
+	RenderReserve(&context, &context.faces, end_face_count, first_face);
+	RenderReserve(&context, &context.face_indices, end_face_count, first_face);
+	RenderReserve(&context, &context.color_x, end_face_count, first_face);
+	RenderReserve(&context, &context.color_y, end_face_count, first_face);
+	RenderReserve(&context, &context.color_z, end_face_count, first_face);
+	if (painter)
+	{
+		RenderReserve(&context, &context.sort_keys, end_face_count, first_face);
+		RenderReserve(&context, &context.sort_temp, end_face_count);
+	}
+	Face* faces = context.faces.data + first_face;
+	uint32_t* face_indices = context.face_indices.data + first_face;
+	SortKey* sort_keys = context.sort_keys.data + first_face;
 
 	// Painter's Algorithm -- render furthest faces first, effectively removing the need for depth-testing!
-	std::sort(faces.begin(), faces.end(), pr);
+	// The key is computed once per face (inverted so the furthest face gets the smallest key). The sum orders the same as the average
+	auto sort_key = [first_face](const Face& face, size_t i)
+	{
+		return SortKey{ ~SortKeyFromFloat(face.positions_clip[0].z + face.positions_clip[1].z + face.positions_clip[2].z), (uint32_t)(first_face + i) };
+	};
+
+	// Stage 2 -- gather the visible faces
+	auto gather = [&](size_t begin, size_t end, int /*worker*/)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			uint32_t f = visible[i];
+			Face& face = faces[i];
+			size_t v[3];
+			DrawFaceVertices(*batch, f, v);
+			for (size_t j = 0; j < 3; j++)
+				face.positions_clip[j] = { clip.x[v[j]], clip.y[v[j]], clip.z[v[j]] };
+			face_indices[i] = f;
+
+			if (painter)
+				sort_keys[i] = sort_key(face, i);
+		}
+	};
+	JobsParallelFor(visible_count, DRAW_CHUNK_SIZE, gather);
+
+	// Stage 3 -- clip faces crossing the near plane in homogeneous space. Their divided positions are unusable,
+	// so clip-space positions are recomputed from the mesh. Each clipped triangle keeps the winding of the face it came from
+	size_t batch_count = visible_count;
+	for (size_t i = 0; i < near_count; i++)
+	{
+		uint32_t f = near[i];
+		size_t instance = f / mesh_face_count;
+		size_t mesh_face = f - instance * mesh_face_count;
+		Vector4 positions_clip[3];
+		for (size_t j = 0; j < 3; j++)
+		{
+			Vector3 p = MeshCorner(mesh, mesh_face * 3 + j);
+			positions_clip[j] = Vector4{ p.x, p.y, p.z, 1.0f } * instance_mvp[instance];
+		}
+
+		Vector3 clipped[6];
+		int triangles = ClipNear(positions_clip, clipped);
+		for (int t = 0; t < triangles; t++)
+		{
+			Vector3 v0 = clipped[t * 3 + 0];
+			Vector3 v1 = clipped[t * 3 + 1];
+			Vector3 v2 = clipped[t * 3 + 2];
+			float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+			if (!(area > 0.0f)) continue;
+
+			Face& face = faces[batch_count];
+			face.positions_clip[0] = v0;
+			face.positions_clip[1] = v1;
+			face.positions_clip[2] = v2;
+			face_indices[batch_count] = f;
+			if (painter)
+				sort_keys[batch_count] = sort_key(face, batch_count);
+			batch_count++;
+		}
+	}
+
+	context.stats.frame_faces += mesh_face_count * visible_instances;
+	context.stats.frame_faces_visible += batch_count;
+	context.stats.frame_faces_clipped += near_count;
 
-	for (const Face& face : faces)
+	batch->count = batch_count;
+	batch->faces = face_indices;
+	batch->colors = { context.color_x.data + first_face, context.color_y.data + first_face, context.color_z.data + first_face };
+	batch->world = { world.x, world.y, world.z };
+	batch->normals = mesh.normals.data();
+	batch->normal_matrices = instance_normal;
+	return true;
+}
+
+bool DrawMeshPrepare(const Mesh& mesh, const UniformData& data, MeshBatch* batch, const Matrix* instances, size_t instance_count)
+{
+	return PrepareMesh(mesh, data, batch, instances, instance_count, 0);
+}
+
+// Rasterizes faces (in order, if given) into fb. Faces are binned into DRAW_TILE_SIZE squares, then every tile is rasterized
+// on its own thread, scissored to the tile. Tiles don't overlap so threads never touch the same pixel and need no locks,
+// and each tile's slice of the color and depth buffers stays in cache while its faces are drawn
+static void RasterFaces(Framebuffer* fb, const Face* faces, ConstFloat3Stream colors, const SortKey* order, size_t count, bool depth_test, bool wireframe)
+{
+	int tiles_x = (fb->width + DRAW_TILE_SIZE - 1) / DRAW_TILE_SIZE;
+	int tiles_y = (fb->height + DRAW_TILE_SIZE - 1) / DRAW_TILE_SIZE;
+	size_t tile_count = tiles_x * tiles_y;
+	RenderReserve(&context, &context.face_tiles, count);
+	RenderReserve(&context, &context.tile_offsets, tile_count + 1);
+	RenderReserve(&context, &context.tile_cursors, tile_count);
+	RasterRect* face_tiles = context.face_tiles.data;
+	uint32_t* tile_offsets = context.tile_offsets.data;
+	uint32_t* tile_cursors = context.tile_cursors.data;
+
+	// Binning pass 1 -- the range of tiles each face overlaps, empty if it's off-screen
+	auto bound = [&](size_t begin, size_t end, int /*worker*/)
 	{
-		Vector3 v0 = face.positions_clip[0];
-		Vector3 v1 = face.positions_clip[1];
-		Vector3 v2 = face.positions_clip[2];
+		for (size_t i = begin; i < end; i++)
+		{
+			const Vector3* v = faces[order != nullptr ? order[i].index : i].positions_clip;
+			RasterRect bounds;
+			if (RasterBounds(*fb, v[0], v[1], v[2], &bounds))
+			{
+				face_tiles[i] = {
+					bounds.x_min / DRAW_TILE_SIZE, bounds.y_min / DRAW_TILE_SIZE,
+					(bounds.x_max - 1) / DRAW_TILE_SIZE + 1, (bounds.y_max - 1) / DRAW_TILE_SIZE + 1 };
+			}
+			else
+			{
+				face_tiles[i] = {};
+			}
+		}
+	};
+	JobsParallelFor(count, DRAW_CHUNK_SIZE, bound);
 
-		// Backface culling
-		Vector3 face_normal = Vector3Normalize(Vector3CrossProduct(Vector3Normalize(v1 - v0), Vector3Normalize(v2 - v0)));
-		if (Vector3DotProduct(face_normal, Vector3UnitZ) < 0.0f) continue;
+	// Binning pass 2 -- count faces per tile, then list them. Faces are listed in submission order so painter's order survives
+	std::fill(tile_offsets, tile_offsets + tile_count + 1, 0);
+	for (size_t i = 0; i < count; i++)
+	{
+		RasterRect r = face_tiles[i];
+		for (int ty = r.y_min; ty < r.y_max; ty++)
+			for (int tx = r.x_min; tx < r.x_max; tx++)
+				tile_offsets[ty * tiles_x + tx + 1]++;
+	}
+	for (size_t t = 0; t < tile_count; t++)
+	{
+		tile_offsets[t + 1] += tile_offsets[t];
+		tile_cursors[t] = tile_offsets[t];
+	}
 
-		Vector3 p = (face.positions_world[0] + face.positions_world[1] + face.positions_world[2]) / 3.0f;
-		Vector3 n = face.normal_world;
+	RenderReserve(&context, &context.tile_faces, tile_offsets[tile_count]);
+	uint32_t* tile_faces = context.tile_faces.data;
+	for (size_t i = 0; i < count; i++)
+	{
+		RasterRect r = face_tiles[i];
+		uint32_t k = order != nullptr ? order[i].index : (uint32_t)i;
+		for (int ty = r.y_min; ty < r.y_max; ty++)
+			for (int tx = r.x_min; tx < r.x_max; tx++)
+				tile_faces[tile_cursors[ty * tiles_x + tx]++] = k;
+	}
 
-		Fragment frag;
-		frag.p = p;
-		frag.n = n;
+	// Rasterize one tile per job
+	auto raster = [&](size_t begin, size_t end, int /*worker*/)
+	{
+		for (size_t t = begin; t < end; t++)
+		{
+			int tx = (int)(t % tiles_x);
+			int ty = (int)(t / tiles_x);
+			RasterRect scissor = {
+				tx * DRAW_TILE_SIZE, ty * DRAW_TILE_SIZE,
+				std::min((tx + 1) * DRAW_TILE_SIZE, fb->width), std::min((ty + 1) * DRAW_TILE_SIZE, fb->height) };
 
-		Vector3 color = shader(data, frag);
-		App::DrawTriangle(v0.x, v0.y, v1.x, v1.y, v2.x, v2.y, color.x, color.y, color.z, wireframe);
+			for (uint32_t j = tile_offsets[t]; j < tile_offsets[t + 1]; j++)
+			{
+				uint32_t k = tile_faces[j];
+				const Vector3* v = faces[k].positions_clip;
+				Vector3 color = { colors.x[k], colors.y[k], colors.z[k] };
+				if (wireframe)
+				{
+					RasterLine(fb, v[0], v[1], color, depth_test, &scissor);
+					RasterLine(fb, v[1], v[2], color, depth_test, &scissor);
+					RasterLine(fb, v[2], v[0], color, depth_test, &scissor);
+				}
+				else
+				{
+					RasterTriangle(fb, v[0], v[1], v[2], color, depth_test, &scissor);
+				}
+			}
+		}
+	};
+	JobsParallelFor(tile_count, 1, raster);
+}
+
+// The depth buffer resolves visibility per-pixel, so faces can be rasterized in any order.
+// Painter's mode instead radix-sorts the 8-byte keys and returns the sorted keys, whose indices give the order to draw faces in.
+// owner and number_count are only needed by coherent sorting, see SortCoherent
+static const SortKey* SortFaces(const void* owner, size_t number_count, size_t face_count)
+{
+	SortKey* sort_keys = context.sort_keys.data;
+	if (context.mode == RENDER_MODE_PAINTER)
+	{
+		context.stats.sorts_full++;
+		return SortRadix(sort_keys, context.sort_temp.data, face_count);
+	}
+	if (context.mode == RENDER_MODE_PAINTER_COHERENT)
+		return SortCoherent(owner, number_count, context.face_indices.data, sort_keys, face_count);
+	return nullptr;
+}
+
+// Submits face_count faces starting at first -- of order if the faces were sorted, or of the faces themselves if not
+static void SubmitFaces(const SortKey* order, size_t first, size_t face_count, bool wireframe)
+{
+	const Face* faces = context.faces.data;
+	ConstFloat3Stream colors = { context.color_x.data, context.color_y.data, context.color_z.data };
+	if (order != nullptr)
+	{
+		order += first;
+	}
+	else
+	{
+		faces += first;
+		colors = { colors.x + first, colors.y + first, colors.z + first };
+	}
+
+	// Back end (render target) -- rasterize the sorted faces without depth testing, as OpenGL would draw them
+	Framebuffer* target = context.target;
+	if (order != nullptr && target != nullptr)
+	{
+		RasterFaces(target, faces, colors, order, face_count, false, wireframe);
+		return;
+	}
+
+	// Back end (painter's) -- append the sorted faces to the frame's triangle stream, which DrawEnd submits in one call.
+	// Only the stream is shared between meshes, so later meshes still draw over earlier ones
+	if (order != nullptr)
+	{
+		TriangleStream& stream = context.triangles;
+		if (stream.wireframe != wireframe)
+			FlushTriangles();
+
+		// Workspaces don't keep their contents when they grow, so queued triangles are drawn first.
+		// Growing to fit everything queued this frame means the whole frame fits from the next frame on
+		size_t stream_count = stream.count + face_count;
+		if (stream_count * 6 > stream.xy.capacity)
+			FlushTriangles();
+		RenderReserve(&context, &stream.xy, stream_count * 6);
+		RenderReserve(&context, &stream.rgb, stream_count * 9);
+		stream.wireframe = wireframe;
+
+		float* xy = stream.xy.data + stream.count * 6;
+		float* rgb = stream.rgb.data + stream.count * 9;
+		auto fill = [&](size_t begin, size_t end, int /*worker*/)
+		{
+			for (size_t i = begin; i < end; i++)
+			{
+				uint32_t k = order[i].index;
+				const Face& face = faces[k];
+				Vector3 color = { colors.x[k], colors.y[k], colors.z[k] };
+				for (size_t j = 0; j < 3; j++)
+				{
+					xy[i * 6 + j * 2 + 0] = face.positions_clip[j].x;
+					xy[i * 6 + j * 2 + 1] = face.positions_clip[j].y;
+					rgb[i * 9 + j * 3 + 0] = color.x;
+					rgb[i * 9 + j * 3 + 1] = color.y;
+					rgb[i * 9 + j * 3 + 2] = color.z;
+				}
+			}
+		};
+		JobsParallelFor(face_count, DRAW_CHUNK_SIZE, fill);
+		stream.count += face_count;
+		return;
+	}
+
+	// Back end (depth) -- the depth buffer resolves visibility, so faces are rasterized in whatever order they're in
+	Framebuffer* fb = target != nullptr ? target : &context.framebuffer;
+	RasterFaces(fb, faces, colors, nullptr, face_count, true, wireframe);
+}
+
+void DrawMeshSubmit(const Mesh& mesh, const MeshBatch& batch, bool wireframe)
+{
+	const SortKey* order = SortFaces(&mesh, batch.mesh_face_count * batch.instance_count, batch.count);
+	SubmitFaces(order, 0, batch.count, wireframe);
+}
+
+void DrawMesh(const Mesh& mesh, const UniformData& data, FragmentShader shader, bool wireframe)
+{
+	DrawMesh<FragmentShader>(mesh, data, shader, wireframe);
+}
+
+void DrawMeshInstanced(const Mesh& mesh, const UniformData& data, const Matrix* instances, size_t instance_count, FragmentShader shader, bool wireframe)
+{
+	DrawMeshInstanced<FragmentShader>(mesh, data, instances, instance_count, shader, wireframe);
+}
+
+// Each job gathers its chunk's fragments into arrays on its own stack, then shades them with one call
+static void ShadeBatch(const MeshBatch& batch, const UniformData& data, BatchShader shader)
+{
+	auto shade = [&](size_t begin, size_t end, int /*worker*/)
+	{
+		alignas(64) float px[DRAW_CHUNK_SIZE], py[DRAW_CHUNK_SIZE], pz[DRAW_CHUNK_SIZE];
+		alignas(64) float nx[DRAW_CHUNK_SIZE], ny[DRAW_CHUNK_SIZE], nz[DRAW_CHUNK_SIZE];
+		for (size_t i = begin; i < end; i++)
+		{
+			Fragment f = DrawFragment(batch, batch.faces[i]);
+			size_t j = i - begin;
+			px[j] = f.p.x;
+			py[j] = f.p.y;
+			pz[j] = f.p.z;
+			nx[j] = f.n.x;
+			ny[j] = f.n.y;
+			nz[j] = f.n.z;
+		}
+
+		FragmentStream fragments = { { px, py, pz }, { nx, ny, nz } };
+		Float3Stream colors = { batch.colors.x + begin, batch.colors.y + begin, batch.colors.z + begin };
+		shader(data, fragments, colors, end - begin);
+	};
+	JobsParallelFor(batch.count, DRAW_CHUNK_SIZE, shade);
+}
+
+void DrawMesh(const Mesh& mesh, const UniformData& data, BatchShader shader, bool wireframe)
+{
+	const Mesh& lod = DrawSelectLod(mesh, data.mvp);
+	MeshBatch batch;
+	if (!DrawMeshPrepare(lod, data, &batch)) return;
+	ShadeBatch(batch, data, shader);
+	DrawMeshSubmit(lod, batch, wireframe);
+}
+
+void DrawMeshInstanced(const Mesh& mesh, const UniformData& data, const Matrix* instances, size_t instance_count, BatchShader shader, bool wireframe)
+{
+	size_t max_instances = DrawMaxInstances(mesh);
+	if (instance_count > max_instances)
+	{
+		for (size_t first = 0; first < instance_count; first += max_instances)
+			DrawMeshInstanced(mesh, data, instances + first, std::min(instance_count - first, max_instances), shader, wireframe);
+		return;
+	}
+
+	DrawLodGroup groups[DRAW_MAX_LOD_GROUPS];
+	size_t group_count = DrawGroupInstances(mesh, data.mvp, instances, instance_count, groups);
+	for (size_t g = 0; g < group_count; g++)
+	{
+		MeshBatch batch;
+		if (!DrawMeshPrepare(*groups[g].lod, data, &batch, groups[g].instances, groups[g].instance_count)) continue;
+		ShadeBatch(batch, data, shader);
+		DrawMeshSubmit(*groups[g].lod, batch, wireframe);
+	}
+}
+
+static void Enqueue(const Mesh& mesh, const UniformData& data, FragmentShader fragment_shader, BatchShader batch_shader, bool wireframe)
+{
+	size_t count = context.queue_count;
+	RenderReserve(&context, &context.queue, count + 1, count);
+	QueuedDraw& draw = context.queue[count];
+	draw.mesh = &mesh;
+	draw.data = data;
+	draw.fragment_shader = fragment_shader;
+	draw.batch_shader = batch_shader;
+	draw.wireframe = wireframe;
+	draw.first_face = 0;
+	context.queue_count++;
+	context.stats.frame_meshes_queued++;
+}
+
+void DrawQueue(const Mesh& mesh, const UniformData& data, FragmentShader shader, bool wireframe)
+{
+	Enqueue(mesh, data, shader, nullptr, wireframe);
+}
+
+void DrawQueue(const Mesh& mesh, const UniformData& data, BatchShader shader, bool wireframe)
+{
+	Enqueue(mesh, data, nullptr, shader, wireframe);
+}
+
+// Every queued draw is prepared and shaded in turn, appending its faces after the last one's, so the whole queue
+// ends up in one set of buffers. Then every face is sorted at once and submitted in one batch
+static void FlushQueue()
+{
+	size_t queue_count = context.queue_count;
+	if (queue_count == 0) return;
+	context.queue_count = 0;
+
+	// Face numbers are offset by the faces of the draws before, so coherent sorting can tell every face in the queue apart
+	QueuedDraw* queue = context.queue.data;
+	size_t face_count = 0;
+	size_t number_count = 0;
+	for (size_t i = 0; i < queue_count; i++)
+	{
+		QueuedDraw& draw = queue[i];
+		draw.first_face = (uint32_t)face_count;
+		const Mesh& lod = DrawSelectLod(*draw.mesh, draw.data.mvp);
+		size_t first_number = number_count;
+		number_count += lod.face_count;
+		assert(number_count <= UINT32_MAX && "Face numbers are 32-bit, too many faces queued");
+
+		MeshBatch batch;
+		if (!PrepareMesh(lod, draw.data, &batch, nullptr, 1, face_count)) continue;
+		if (draw.batch_shader != nullptr)
+			ShadeBatch(batch, draw.data, draw.batch_shader);
+		else
+			DrawMeshShade(batch, draw.data, draw.fragment_shader);
+
+		uint32_t* face_indices = context.face_indices.data + face_count;
+		for (size_t j = 0; j < batch.count; j++)
+			face_indices[j] += (uint32_t)first_number;
+		face_count += batch.count;
+	}
+	if (face_count == 0) return;
+
+	const SortKey* order = SortFaces(&context.queue, number_count, face_count);
+	bool mixed = false;
+	for (size_t i = 1; i < queue_count; i++)
+		mixed |= queue[i].wireframe != queue[0].wireframe;
+	if (!mixed)
+	{
+		SubmitFaces(order, 0, face_count, queue[0].wireframe);
+		return;
+	}
+
+	// Faces can only be submitted together if they share a wireframe setting, so the sorted faces are split where it changes
+	auto wireframe_at = [&](size_t i)
+	{
+		uint32_t k = order != nullptr ? order[i].index : (uint32_t)i;
+		const QueuedDraw* draw = std::upper_bound(queue, queue + queue_count, k,
+			[](uint32_t face, const QueuedDraw& d) { return face < d.first_face; }) - 1;
+		return draw->wireframe;
+	};
+	size_t run = 0;
+	bool run_wireframe = wireframe_at(0);
+	for (size_t i = 1; i <= face_count; i++)
+	{
+		bool wireframe = i < face_count ? wireframe_at(i) : !run_wireframe;
+		if (wireframe == run_wireframe) continue;
+		SubmitFaces(order, run, i - run, run_wireframe);
+		run = i;
+		run_wireframe = wireframe;
 	}
 }
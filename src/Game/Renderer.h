@@ -1,5 +1,7 @@
 #pragma once
 #include "Mesh.h"
+#include "Jobs.h"
+#include "Rasterizer.h"
 // All "Renderer" functions will be prefixed by "Draw" (just like how all "Mesh" functions are prefixed by "Mesh")
 
 struct UniformData
@@ -27,8 +29,245 @@ struct Fragment
 
 using FragmentShader = Vector3(*)(const UniformData& u, const Fragment& f);
 
+// Structure-of-arrays fragments, for shaders that work on many at once
+struct FragmentStream
+{
+	ConstFloat3Stream p;
+	ConstFloat3Stream n;
+};
+
+// Shades count fragments, writing one color per fragment to out. Called once per chunk of faces rather than once per face
+using BatchShader = void(*)(const UniformData& u, FragmentStream in, Float3Stream out, size_t count);
+
+enum RenderMode
+{
+	RENDER_MODE_DEPTH,		// Rasterize into a CPU framebuffer with a depth buffer, blitted once per frame by DrawEnd
+	RENDER_MODE_PAINTER,	// Sort faces back-to-front and submit them to OpenGL in one batch per frame by DrawEnd
+	RENDER_MODE_PAINTER_COHERENT,	// Painter's, but start from each mesh's order last frame and only fully re-sort if it's too far off
+	RENDER_MODE_COUNT
+};
+
+struct RenderStats
+{
+	size_t frame_allocations = 0;	// Heap allocations made by the renderer since the last DrawBegin, 0 once workspaces have grown to fit
+	size_t total_allocations = 0;	// Heap allocations made by the renderer since startup
+	size_t workspace_bytes = 0;		// Memory currently held by the renderer's workspaces
+
+	size_t frame_faces = 0;			// Faces passed to DrawMesh since the last DrawBegin
+	size_t frame_faces_visible = 0;	// Triangles that survived clipping and culling and went on to be shaded and sorted
+	size_t frame_faces_clipped = 0;	// Faces that crossed the near plane and had to be clipped
+	size_t frame_draw_calls = 0;	// Calls into App's draw functions since the last DrawBegin
+
+	size_t frame_meshes = 0;		// DrawMesh calls since the last DrawBegin
+	size_t frame_meshes_culled = 0;	// Of those, meshes whose bounds were outside the frustum or hidden by the depth pyramid
+	size_t frame_meshes_lod = 0;	// Of those not culled, meshes drawn with one of their simplified LODs
+	size_t frame_meshes_queued = 0;	// DrawQueue calls since the last DrawBegin, counted in frame_meshes once drawn
+	size_t frame_meshlets = 0;		// Meshlets of the meshes that weren't culled
+	size_t frame_meshlets_culled = 0;	// Of those, meshlets outside the frustum or facing away from the camera
+	size_t frame_transform_hits = 0;	// Meshes drawn with the same matrices as when they were last transformed, reusing those vertices
+	size_t frame_transform_misses = 0;	// Meshes that had to be transformed again. Instanced draws are neither
+	size_t frame_vertices = 0;			// Vertices run through the transform kernels, padding included. Indexed meshes transform each shared vertex once
+
+	size_t sorts_full = 0;			// Painter's sorts done from scratch since startup
+	size_t sorts_repaired = 0;		// Coherent painter's sorts that only had to repair last frame's order
+};
+
+const RenderStats& DrawGetStats();
+
+void DrawSetMode(RenderMode mode);
+RenderMode DrawGetMode();
+
+// Where frames are drawn. nullptr (the default) is the window, through App.
+// Otherwise every mode rasterizes into target on the CPU and nothing calls OpenGL, so frames can be rendered
+// (and benchmarked or compared against a reference image) without a window. DrawBegin clears target, DrawEnd leaves it for the caller.
+// target must be made with FramebufferCreate and outlive its use
+void DrawSetTarget(Framebuffer* target);
+Framebuffer* DrawGetTarget();
+
+// Every frame's DrawMesh calls must be enclosed by DrawBegin and DrawEnd
+void DrawBegin();
+void DrawEnd();
+
+// Hierarchical-Z occlusion culling. Builds a low-resolution depth pyramid from everything drawn so far this frame,
+// then every later DrawMesh tests its mesh's bounding box against it and skips the mesh (before transforming anything) if it's hidden.
+// Draw big occluders first, call this, then draw the rest. Needs a CPU depth buffer, so it does nothing in painter's modes drawing to the window.
+// The pyramid lasts until the next DrawBegin. Meshes are always tested against the frustum.
+// Queued draws (see DrawQueue) are drawn first, so they occlude too
+void DrawBuildOcclusion();
+
+// Faces shaded per job (and transformed, culled and submitted per job in the other stages)
+constexpr size_t DRAW_CHUNK_SIZE = 512;
+
+// Faces left after culling and clipping, waiting for a color from the shading stage.
+// Faces are numbered instance * mesh_face_count + mesh face, so a mesh drawn once is just instance 0
+struct MeshBatch
+{
+	size_t count = 0;
+	const uint32_t* faces = nullptr;	// Face number of each face
+	Float3Stream colors = {};			// Output, one color per face
+	ConstFloat3Stream world = {};		// World-space vertices, 3 per face number (see DrawFaceVertices)
+	const Vector3* normals = nullptr;
+	size_t mesh_face_count = 0;
+	size_t instance_count = 0;
+	const Matrix* normal_matrices = nullptr;	// One per instance
+
+	// Indexed meshes only (see MeshBuildIndexed) -- world holds each instance's vertices vertex_stride apart, found through the mesh's indices
+	const uint16_t* indices_16 = nullptr;
+	const uint32_t* indices_32 = nullptr;
+	size_t vertex_stride = 0;
+
+	// Quantized meshes only (see MeshQuantize) -- normals are decoded from one of these instead
+	const uint16_t* normals_oct_8 = nullptr;
+	const uint32_t* normals_oct_16 = nullptr;
+};
+
+// Where face number face's corners are in batch.world. Unindexed meshes keep them at face * 3
+inline void DrawFaceVertices(const MeshBatch& batch, uint32_t face, size_t v[3])
+{
+	if (batch.vertex_stride == 0)
+	{
+		v[0] = (size_t)face * 3;
+		v[1] = v[0] + 1;
+		v[2] = v[0] + 2;
+		return;
+	}
+
+	size_t instance = batch.instance_count > 1 ? face / batch.mesh_face_count : 0;
+	size_t corner = (face - instance * batch.mesh_face_count) * 3;
+	size_t first = instance * batch.vertex_stride;
+	for (size_t j = 0; j < 3; j++)
+		v[j] = first + (batch.indices_16 != nullptr ? batch.indices_16[corner + j] : batch.indices_32[corner + j]);
+}
+
+// Largest simplification error a LOD may show on screen, in pixels
+constexpr float DRAW_LOD_MAX_ERROR = 1.0f;
+
+// The coarsest of mesh's LODs (or mesh itself) whose error stays under DRAW_LOD_MAX_ERROR pixels at the size mvp projects it to.
+// DrawMesh calls this, so meshes with LODs get them automatically
+const Mesh& DrawSelectLod(const Mesh& mesh, const Matrix& mvp);
+
+// Instances of one mesh that all need the same LOD
+struct DrawLodGroup
+{
+	const Mesh* lod;			// mesh itself or one of its LODs
+	const Matrix* instances;
+	size_t instance_count;
+};
+
+constexpr size_t DRAW_MAX_LOD_GROUPS = MESH_LOD_MAX_LEVELS + 1;
+
+// Sorts instances (as passed to DrawMeshInstanced) by the LOD DrawSelectLod would pick for each on its own, filling up to
+// DRAW_MAX_LOD_GROUPS groups coarsest first and returning how many. Instances whose bounds are culled are left out.
+// The groups' matrices belong to the renderer and are only valid until the next call
+size_t DrawGroupInstances(const Mesh& mesh, const Matrix& mvp, const Matrix* instances, size_t instance_count, DrawLodGroup* groups);
+
+// DrawMesh's shader-independent stages, the templated DrawMesh runs its shading loop between them.
+// DrawMeshPrepare transforms, clips and culls the mesh (or every instance of it), returning false if all of it was culled.
+// DrawMeshSubmit sorts (in painter's modes) and submits every face in batch
+bool DrawMeshPrepare(const Mesh& mesh, const UniformData& data, MeshBatch* batch, const Matrix* instances = nullptr, size_t instance_count = 1);
+void DrawMeshSubmit(const Mesh& mesh, const MeshBatch& batch, bool wireframe);
+
+// Flat shading -- one fragment per face at its world-space centroid, so clipping doesn't change a face's color
+inline Fragment DrawFragment(const MeshBatch& batch, uint32_t face)
+{
+	size_t instance = batch.instance_count > 1 ? face / batch.mesh_face_count : 0;
+	size_t v[3];
+	DrawFaceVertices(batch, face, v);
+	const ConstFloat3Stream& w = batch.world;
+	Fragment f;
+	f.p = Vector3{
+		w.x[v[0]] + w.x[v[1]] + w.x[v[2]],
+		w.y[v[0]] + w.y[v[1]] + w.y[v[2]],
+		w.z[v[0]] + w.z[v[1]] + w.z[v[2]] } / 3.0f;
+	size_t mesh_face = face - instance * batch.mesh_face_count;
+	Vector3 n =
+		batch.normals_oct_16 != nullptr ? MeshDecodeNormal16(batch.normals_oct_16[mesh_face]) :
+		batch.normals_oct_8 != nullptr ? MeshDecodeNormal8(batch.normals_oct_8[mesh_face]) :
+		batch.normals[mesh_face];
+	f.n = Vector3Normalize(n * batch.normal_matrices[instance]);
+	return f;
+}
+
+// Runs shader on every face of batch, writing batch.colors
+template<typename Shader>
+void DrawMeshShade(const MeshBatch& batch, const UniformData& data, Shader shader)
+{
+	auto shade = [&](size_t begin, size_t end, int /*worker*/)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			Vector3 c = shader(data, DrawFragment(batch, batch.faces[i]));
+			batch.colors.x[i] = c.x;
+			batch.colors.y[i] = c.y;
+			batch.colors.z[i] = c.z;
+		}
+	};
+	JobsParallelFor(batch.count, DRAW_CHUNK_SIZE, shade);
+}
+
+// Shader is any callable with the signature of FragmentShader. Functors (ie PhongShader) are compiled into the shading loop,
+// so the call is inlined instead of being made indirectly for every face
+template<typename Shader>
+void DrawMesh(const Mesh& mesh, const UniformData& data, Shader shader, bool wireframe = false)
+{
+	const Mesh& lod = DrawSelectLod(mesh, data.mvp);
+	MeshBatch batch;
+	if (!DrawMeshPrepare(lod, data, &batch)) return;
+	DrawMeshShade(batch, data, shader);
+	DrawMeshSubmit(lod, batch, wireframe);
+}
+
+// Runtime-selected shaders. Every face pays for an indirect call
 void DrawMesh(const Mesh& mesh, const UniformData& data, FragmentShader shader, bool wireframe = false);
 
+// Runtime-selected batch shaders. Fragments are gathered into arrays a chunk at a time and shaded with one call per chunk
+void DrawMesh(const Mesh& mesh, const UniformData& data, BatchShader shader, bool wireframe = false);
+
+// Face numbers are 32-bit, so one pass can only hold as many instances of mesh as there are numbers for.
+// DrawMeshInstanced splits larger draws into passes of at most this many instances
+inline size_t DrawMaxInstances(const Mesh& mesh)
+{
+	return mesh.face_count > 0 ? UINT32_MAX / mesh.face_count : SIZE_MAX;
+}
+
+// Draws mesh once per matrix in instances, as if by DrawMesh with data.world and data.mvp premultiplied by the instance's matrix
+// (so with data.world set to identity and data.mvp to view * proj, instances are plain world matrices).
+// Every instance is transformed in the same pass and their faces are culled, shaded, sorted and submitted together,
+// so many small meshes cost about as much as one mesh with as many faces. Each instance gets the LOD it needs: instances are grouped
+// by LOD (see DrawGroupInstances) and each group is drawn in one pass, coarsest first. Faces are only sorted within a group
+template<typename Shader>
+void DrawMeshInstanced(const Mesh& mesh, const UniformData& data, const Matrix* instances, size_t instance_count, Shader shader, bool wireframe = false)
+{
+	size_t max_instances = DrawMaxInstances(mesh);
+	if (instance_count > max_instances)
+	{
+		for (size_t first = 0; first < instance_count; first += max_instances)
+			DrawMeshInstanced<Shader>(mesh, data, instances + first, instance_count - first < max_instances ? instance_count - first : max_instances, shader, wireframe);
+		return;
+	}
+
+	DrawLodGroup groups[DRAW_MAX_LOD_GROUPS];
+	size_t group_count = DrawGroupInstances(mesh, data.mvp, instances, instance_count, groups);
+	for (size_t g = 0; g < group_count; g++)
+	{
+		MeshBatch batch;
+		if (!DrawMeshPrepare(*groups[g].lod, data, &batch, groups[g].instances, groups[g].instance_count)) continue;
+		DrawMeshShade(batch, data, shader);
+		DrawMeshSubmit(*groups[g].lod, batch, wireframe);
+	}
+}
+
+void DrawMeshInstanced(const Mesh& mesh, const UniformData& data, const Matrix* instances, size_t instance_count, FragmentShader shader, bool wireframe = false);
+void DrawMeshInstanced(const Mesh& mesh, const UniformData& data, const Matrix* instances, size_t instance_count, BatchShader shader, bool wireframe = false);
+
+// Frame-level draw queue. Queued meshes are drawn together by DrawEnd (or DrawBuildOcclusion, if it comes first):
+// each is transformed, culled and shaded into the same buffers, then all of their faces are sorted at once and submitted in one batch.
+// In painter's modes faces of different meshes interleave correctly instead of each mesh being drawn over the ones before it.
+// Queued meshes are drawn after every DrawMesh call made so far. data is copied, mesh must stay loaded until the queue is drawn.
+// Draws with different wireframe settings are still sorted together, but the batch is split wherever the setting changes
+void DrawQueue(const Mesh& mesh, const UniformData& data, FragmentShader shader, bool wireframe = false);
+void DrawQueue(const Mesh& mesh, const UniformData& data, BatchShader shader, bool wireframe = false);
+
 inline Vector3 ShadePositions(const UniformData& u, const Fragment& f)
 {
 	Vector3 c = Vector3Normalize(f.p) * 0.5f + Vector3Ones * 0.5f;
@@ -58,3 +297,24 @@ inline Vector3 ShadePhong(const UniformData& u, const Fragment& f)
 	Vector3 c = u.object_color * lighting;
 	return c;
 }
+
+// Batch versions of the shaders above. 4 fragments at a time with SSE, falling back to the scalar shaders elsewhere
+void ShadePositionsBatch(const UniformData& u, FragmentStream in, Float3Stream out, size_t count);
+void ShadeNormalsBatch(const UniformData& u, FragmentStream in, Float3Stream out, size_t count);
+void ShadePhongBatch(const UniformData& u, FragmentStream in, Float3Stream out, size_t count);
+
+// Functor versions of the shaders above, for the templated DrawMesh
+struct PositionsShader
+{
+	Vector3 operator()(const UniformData& u, const Fragment& f) const { return ShadePositions(u, f); }
+};
+
+struct NormalsShader
+{
+	Vector3 operator()(const UniformData& u, const Fragment& f) const { return ShadeNormals(u, f); }
+};
+
+struct PhongShader
+{
+	Vector3 operator()(const UniformData& u, const Fragment& f) const { return ShadePhong(u, f); }
+};
@@ -0,0 +1,162 @@
+#include "Renderer.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SHADE_X86 1
+#include <immintrin.h>
+#else
+#define SHADE_X86 0
+#endif
+
+// Every batch shader runs its SIMD loop over whole registers, then finishes the last few fragments with the scalar shader.
+// The SIMD code does the same operations in the same order as raymath, so both give identical colors
+static void ShadeTail(const UniformData& u, FragmentStream in, Float3Stream out, size_t begin, size_t count, FragmentShader shader)
+{
+	for (size_t i = begin; i < count; i++)
+	{
+		Fragment f;
+		f.p = { in.p.x[i], in.p.y[i], in.p.z[i] };
+		f.n = { in.n.x[i], in.n.y[i], in.n.z[i] };
+		Vector3 c = shader(u, f);
+		out.x[i] = c.x;
+		out.y[i] = c.y;
+		out.z[i] = c.z;
+	}
+}
+
+#if SHADE_X86
+
+// 4 vectors, one per lane
+struct Vector3x4
+{
+	__m128 x, y, z;
+};
+
+static inline Vector3x4 Load(ConstFloat3Stream s, size_t i)
+{
+	return { _mm_loadu_ps(s.x + i), _mm_loadu_ps(s.y + i), _mm_loadu_ps(s.z + i) };
+}
+
+static inline void Store(Float3Stream s, size_t i, Vector3x4 v)
+{
+	_mm_storeu_ps(s.x + i, v.x);
+	_mm_storeu_ps(s.y + i, v.y);
+	_mm_storeu_ps(s.z + i, v.z);
+}
+
+static inline Vector3x4 Splat(Vector3 v)
+{
+	return { _mm_set1_ps(v.x), _mm_set1_ps(v.y), _mm_set1_ps(v.z) };
+}
+
+static inline __m128 Dot(Vector3x4 a, Vector3x4 b)
+{
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)), _mm_mul_ps(a.z, b.z));
+}
+
+static inline Vector3x4 Sub(Vector3x4 a, Vector3x4 b)
+{
+	return { _mm_sub_ps(a.x, b.x), _mm_sub_ps(a.y, b.y), _mm_sub_ps(a.z, b.z) };
+}
+
+static inline Vector3x4 Scale(Vector3x4 a, __m128 s)
+{
+	return { _mm_mul_ps(a.x, s), _mm_mul_ps(a.y, s), _mm_mul_ps(a.z, s) };
+}
+
+// v * 0.5 + 0.5, the usual [-1, 1] to [0, 1] remap
+static inline Vector3x4 Remap(Vector3x4 v)
+{
+	const __m128 half = _mm_set1_ps(0.5f);
+	return { _mm_add_ps(_mm_mul_ps(v.x, half), half), _mm_add_ps(_mm_mul_ps(v.y, half), half), _mm_add_ps(_mm_mul_ps(v.z, half), half) };
+}
+
+// Zero-length vectors are left as they are, like Vector3Normalize
+static inline Vector3x4 Normalize(Vector3x4 v)
+{
+	__m128 length = _mm_sqrt_ps(Dot(v, v));
+	__m128 ilength = _mm_and_ps(_mm_div_ps(_mm_set1_ps(1.0f), length), _mm_cmpneq_ps(length, _mm_setzero_ps()));
+	return Scale(v, ilength);
+}
+
+void ShadePositionsBatch(const UniformData& u, FragmentStream in, Float3Stream out, size_t count)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+		Store(out, i, Remap(Normalize(Load(in.p, i))));
+	ShadeTail(u, in, out, i, count, ShadePositions);
+}
+
+void ShadeNormalsBatch(const UniformData& u, FragmentStream in, Float3Stream out, size_t count)
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+		Store(out, i, Remap(Load(in.n, i)));
+	ShadeTail(u, in, out, i, count, ShadeNormals);
+}
+
+void ShadePhongBatch(const UniformData& u, FragmentStream in, Float3Stream out, size_t count)
+{
+	// Terms that don't depend on the fragment are hoisted out of the loop
+	const Vector3x4 light_position = Splat(u.light_position);
+	const Vector3x4 camera_position = Splat(u.camera_position);
+	const Vector3x4 ambient = Splat(u.light_color * u.ambient_strength);
+	const Vector3x4 diffuse = Splat(u.light_color * u.diffuse_strength);
+	const Vector3x4 specular = Splat(u.light_color * u.specular_strength);
+	const Vector3x4 object_color = Splat(u.object_color);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 two = _mm_set1_ps(2.0f);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		Vector3x4 P = Load(in.p, i);
+		Vector3x4 N = Load(in.n, i);
+		Vector3x4 L = Normalize(Sub(light_position, P));
+		Vector3x4 V = Normalize(Sub(camera_position, P));
+
+		// R = reflect(-L, N)
+		Vector3x4 I = Scale(L, _mm_set1_ps(-1.0f));
+		__m128 dotIN = Dot(I, N);
+		Vector3x4 R = {
+			_mm_sub_ps(I.x, _mm_mul_ps(_mm_mul_ps(two, N.x), dotIN)),
+			_mm_sub_ps(I.y, _mm_mul_ps(_mm_mul_ps(two, N.y), dotIN)),
+			_mm_sub_ps(I.z, _mm_mul_ps(_mm_mul_ps(two, N.z), dotIN)) };
+
+		__m128 dotNL = _mm_max_ps(Dot(N, L), zero);
+		__m128 dotVR = _mm_max_ps(Dot(V, R), zero);
+
+		// There's no SIMD pow, so only the specular power is done per-lane
+		alignas(16) float power[4];
+		_mm_store_ps(power, dotVR);
+		for (float& p : power)
+			p = powf(p, u.specular_exponent);
+		__m128 spec = _mm_load_ps(power);
+
+		Vector3x4 lighting = {
+			_mm_add_ps(_mm_add_ps(ambient.x, _mm_mul_ps(diffuse.x, dotNL)), _mm_mul_ps(specular.x, spec)),
+			_mm_add_ps(_mm_add_ps(ambient.y, _mm_mul_ps(diffuse.y, dotNL)), _mm_mul_ps(specular.y, spec)),
+			_mm_add_ps(_mm_add_ps(ambient.z, _mm_mul_ps(diffuse.z, dotNL)), _mm_mul_ps(specular.z, spec)) };
+
+		Store(out, i, { _mm_mul_ps(object_color.x, lighting.x), _mm_mul_ps(object_color.y, lighting.y), _mm_mul_ps(object_color.z, lighting.z) });
+	}
+	ShadeTail(u, in, out, i, count, ShadePhong);
+}
+
+#else
+
+void ShadePositionsBatch(const UniformData& u, FragmentStream in, Float3Stream out, size_t count)
+{
+	ShadeTail(u, in, out, 0, count, ShadePositions);
+}
+
+void ShadeNormalsBatch(const UniformData& u, FragmentStream in, Float3Stream out, size_t count)
+{
+	ShadeTail(u, in, out, 0, count, ShadeNormals);
+}
+
+void ShadePhongBatch(const UniformData& u, FragmentStream in, Float3Stream out, size_t count)
+{
+	ShadeTail(u, in, out, 0, count, ShadePhong);
+}
+
+#endif
@@ -0,0 +1,75 @@
+#include "Sort.h"
+
+SortKey* SortRadix(SortKey* keys, SortKey* temp, size_t count)
+{
+	// Histogram every byte in a single read of the keys
+	uint32_t histograms[4][256] = {};
+	for (size_t i = 0; i < count; i++)
+	{
+		uint32_t key = keys[i].key;
+		histograms[0][key & 0xFF]++;
+		histograms[1][(key >> 8) & 0xFF]++;
+		histograms[2][(key >> 16) & 0xFF]++;
+		histograms[3][key >> 24]++;
+	}
+
+	SortKey* src = keys;
+	SortKey* dst = temp;
+	for (int pass = 0; pass < 4; pass++)
+	{
+		uint32_t* histogram = histograms[pass];
+		uint32_t shift = pass * 8;
+
+		// Every key has the same byte so this pass wouldn't change the order
+		if (count > 0 && histogram[(src[0].key >> shift) & 0xFF] == count) continue;
+
+		// Exclusive prefix sum turns counts into output offsets
+		uint32_t offset = 0;
+		for (int digit = 0; digit < 256; digit++)
+		{
+			uint32_t digit_count = histogram[digit];
+			histogram[digit] = offset;
+			offset += digit_count;
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			SortKey k = src[i];
+			dst[histogram[(k.key >> shift) & 0xFF]++] = k;
+		}
+
+		SortKey* swap = src;
+		src = dst;
+		dst = swap;
+	}
+
+	return src;
+}
+
+size_t SortCountDescents(const SortKey* keys, size_t count)
+{
+	size_t descents = 0;
+	for (size_t i = 1; i < count; i++)
+		descents += keys[i - 1].key > keys[i].key;
+	return descents;
+}
+
+bool SortInsertion(SortKey* keys, size_t count, size_t max_moves)
+{
+	size_t moves = 0;
+	for (size_t i = 1; i < count; i++)
+	{
+		SortKey k = keys[i];
+		size_t j = i;
+		while (j > 0 && keys[j - 1].key > k.key)
+		{
+			keys[j] = keys[j - 1];
+			j--;
+		}
+		keys[j] = k;
+
+		moves += i - j;
+		if (moves > max_moves) return false;
+	}
+	return true;
+}
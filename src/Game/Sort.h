@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+// All "Sort" functions order SortKeys by ascending key. Only the 8-byte keys move, never the items they refer to
+
+struct SortKey
+{
+	uint32_t key;
+	uint32_t index;
+};
+
+// Maps a float to a uint32_t with the same ordering, so floats can be radix-sorted as integers
+inline uint32_t SortKeyFromFloat(float f)
+{
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+
+	// Negative floats sort in reverse and below all positive floats: flip all their bits. Positive floats just need the sign bit set
+	uint32_t mask = (uint32_t)(-(int32_t)(bits >> 31)) | 0x80000000;
+	return bits ^ mask;
+}
+
+// Stable LSD radix sort, one pass per byte. Passes where every key has the same byte are skipped.
+// temp must hold count keys. Returns whichever of keys or temp holds the result
+SortKey* SortRadix(SortKey* keys, SortKey* temp, size_t count);
+
+// Number of adjacent pairs that are out of order. A cheap O(n) estimate of how far keys are from sorted
+size_t SortCountDescents(const SortKey* keys, size_t count);
+
+// Stable insertion sort for nearly-sorted keys, O(n + number of inversions).
+// Gives up and returns false once more than max_moves keys have been shifted; keys are then only partially sorted
+bool SortInsertion(SortKey* keys, size_t count, size_t max_moves);
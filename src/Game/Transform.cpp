@@ -0,0 +1,286 @@
+#include "Transform.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define TRANSFORM_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#else
+#define TRANSFORM_X86 0
+#endif
+
+void TransformPositionsScalar(ConstFloat3Stream local, size_t count, const Matrix& world, const Matrix& mvp, Float3Stream world_out, ClipStream clip_out)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		Vector3 position_local = { local.x[i], local.y[i], local.z[i] };
+		Vector3 position_world = position_local * world;
+		Vector3 position_clip = MatrixPerspectiveDivide(mvp, position_local);
+		float w = mvp.m3 * position_local.x + mvp.m7 * position_local.y + mvp.m11 * position_local.z + mvp.m15;
+
+		world_out.x[i] = position_world.x;
+		world_out.y[i] = position_world.y;
+		world_out.z[i] = position_world.z;
+
+		clip_out.x[i] = position_clip.x;
+		clip_out.y[i] = position_clip.y;
+		clip_out.z[i] = position_clip.z;
+		clip_out.w[i] = w;
+	}
+}
+
+void TransformQuantizedScalar(ConstQuantizedStream local, size_t count, const Matrix& world, const Matrix& mvp, Float3Stream world_out, ClipStream clip_out)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		float x = local.x[i];
+		float y = local.y[i];
+		float z = local.z[i];
+		ConstFloat3Stream position = { &x, &y, &z };
+		Float3Stream world_vertex = { world_out.x + i, world_out.y + i, world_out.z + i };
+		ClipStream clip_vertex = { clip_out.x + i, clip_out.y + i, clip_out.z + i, clip_out.w + i };
+		TransformPositionsScalar(position, 1, world, mvp, world_vertex, clip_vertex);
+	}
+}
+
+#if TRANSFORM_X86
+
+// Each output row is a dot product of (x, y, z, 1) with one matrix row, so the rows are splatted once up-front
+// and every instruction then works on a full register of vertices.
+void TransformPositionsSSE(ConstFloat3Stream local, size_t count, const Matrix& world, const Matrix& mvp, Float3Stream world_out, ClipStream clip_out)
+{
+	const __m128 w0 = _mm_set1_ps(world.m0), w4 = _mm_set1_ps(world.m4), w8 = _mm_set1_ps(world.m8), w12 = _mm_set1_ps(world.m12);
+	const __m128 w1 = _mm_set1_ps(world.m1), w5 = _mm_set1_ps(world.m5), w9 = _mm_set1_ps(world.m9), w13 = _mm_set1_ps(world.m13);
+	const __m128 w2 = _mm_set1_ps(world.m2), w6 = _mm_set1_ps(world.m6), w10 = _mm_set1_ps(world.m10), w14 = _mm_set1_ps(world.m14);
+
+	const __m128 c0 = _mm_set1_ps(mvp.m0), c4 = _mm_set1_ps(mvp.m4), c8 = _mm_set1_ps(mvp.m8), c12 = _mm_set1_ps(mvp.m12);
+	const __m128 c1 = _mm_set1_ps(mvp.m1), c5 = _mm_set1_ps(mvp.m5), c9 = _mm_set1_ps(mvp.m9), c13 = _mm_set1_ps(mvp.m13);
+	const __m128 c2 = _mm_set1_ps(mvp.m2), c6 = _mm_set1_ps(mvp.m6), c10 = _mm_set1_ps(mvp.m10), c14 = _mm_set1_ps(mvp.m14);
+	const __m128 c3 = _mm_set1_ps(mvp.m3), c7 = _mm_set1_ps(mvp.m7), c11 = _mm_set1_ps(mvp.m11), c15 = _mm_set1_ps(mvp.m15);
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	for (size_t i = 0; i < count; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(local.x + i);
+		__m128 y = _mm_loadu_ps(local.y + i);
+		__m128 z = _mm_loadu_ps(local.z + i);
+
+		_mm_storeu_ps(world_out.x + i, _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(w0, x), _mm_mul_ps(w4, y)), _mm_mul_ps(w8, z)), w12));
+		_mm_storeu_ps(world_out.y + i, _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(w1, x), _mm_mul_ps(w5, y)), _mm_mul_ps(w9, z)), w13));
+		_mm_storeu_ps(world_out.z + i, _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(w2, x), _mm_mul_ps(w6, y)), _mm_mul_ps(w10, z)), w14));
+
+		__m128 cx = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, x), _mm_mul_ps(c4, y)), _mm_mul_ps(c8, z)), c12);
+		__m128 cy = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c1, x), _mm_mul_ps(c5, y)), _mm_mul_ps(c9, z)), c13);
+		__m128 cz = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c2, x), _mm_mul_ps(c6, y)), _mm_mul_ps(c10, z)), c14);
+		__m128 cw = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c3, x), _mm_mul_ps(c7, y)), _mm_mul_ps(c11, z)), c15);
+		__m128 inv_w = _mm_div_ps(one, cw);
+
+		_mm_storeu_ps(clip_out.x + i, _mm_mul_ps(cx, inv_w));
+		_mm_storeu_ps(clip_out.y + i, _mm_mul_ps(cy, inv_w));
+		_mm_storeu_ps(clip_out.z + i, _mm_mul_ps(cz, inv_w));
+		_mm_storeu_ps(clip_out.w + i, cw);
+	}
+}
+
+TARGET_AVX2 void TransformPositionsAVX2(ConstFloat3Stream local, size_t count, const Matrix& world, const Matrix& mvp, Float3Stream world_out, ClipStream clip_out)
+{
+	const __m256 w0 = _mm256_set1_ps(world.m0), w4 = _mm256_set1_ps(world.m4), w8 = _mm256_set1_ps(world.m8), w12 = _mm256_set1_ps(world.m12);
+	const __m256 w1 = _mm256_set1_ps(world.m1), w5 = _mm256_set1_ps(world.m5), w9 = _mm256_set1_ps(world.m9), w13 = _mm256_set1_ps(world.m13);
+	const __m256 w2 = _mm256_set1_ps(world.m2), w6 = _mm256_set1_ps(world.m6), w10 = _mm256_set1_ps(world.m10), w14 = _mm256_set1_ps(world.m14);
+
+	const __m256 c0 = _mm256_set1_ps(mvp.m0), c4 = _mm256_set1_ps(mvp.m4), c8 = _mm256_set1_ps(mvp.m8), c12 = _mm256_set1_ps(mvp.m12);
+	const __m256 c1 = _mm256_set1_ps(mvp.m1), c5 = _mm256_set1_ps(mvp.m5), c9 = _mm256_set1_ps(mvp.m9), c13 = _mm256_set1_ps(mvp.m13);
+	const __m256 c2 = _mm256_set1_ps(mvp.m2), c6 = _mm256_set1_ps(mvp.m6), c10 = _mm256_set1_ps(mvp.m10), c14 = _mm256_set1_ps(mvp.m14);
+	const __m256 c3 = _mm256_set1_ps(mvp.m3), c7 = _mm256_set1_ps(mvp.m7), c11 = _mm256_set1_ps(mvp.m11), c15 = _mm256_set1_ps(mvp.m15);
+	const __m256 one = _mm256_set1_ps(1.0f);
+
+	for (size_t i = 0; i < count; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(local.x + i);
+		__m256 y = _mm256_loadu_ps(local.y + i);
+		__m256 z = _mm256_loadu_ps(local.z + i);
+
+		_mm256_storeu_ps(world_out.x + i, _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(w0, x), _mm256_mul_ps(w4, y)), _mm256_mul_ps(w8, z)), w12));
+		_mm256_storeu_ps(world_out.y + i, _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(w1, x), _mm256_mul_ps(w5, y)), _mm256_mul_ps(w9, z)), w13));
+		_mm256_storeu_ps(world_out.z + i, _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(w2, x), _mm256_mul_ps(w6, y)), _mm256_mul_ps(w10, z)), w14));
+
+		__m256 cx = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c0, x), _mm256_mul_ps(c4, y)), _mm256_mul_ps(c8, z)), c12);
+		__m256 cy = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c1, x), _mm256_mul_ps(c5, y)), _mm256_mul_ps(c9, z)), c13);
+		__m256 cz = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c2, x), _mm256_mul_ps(c6, y)), _mm256_mul_ps(c10, z)), c14);
+		__m256 cw = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c3, x), _mm256_mul_ps(c7, y)), _mm256_mul_ps(c11, z)), c15);
+		__m256 inv_w = _mm256_div_ps(one, cw);
+
+		_mm256_storeu_ps(clip_out.x + i, _mm256_mul_ps(cx, inv_w));
+		_mm256_storeu_ps(clip_out.y + i, _mm256_mul_ps(cy, inv_w));
+		_mm256_storeu_ps(clip_out.z + i, _mm256_mul_ps(cz, inv_w));
+		_mm256_storeu_ps(clip_out.w + i, cw);
+	}
+}
+
+// The quantized kernels are the float ones with the loads widening 16-bit integers (SSE2 unpacks against zero, AVX2 zero-extends)
+void TransformQuantizedSSE(ConstQuantizedStream local, size_t count, const Matrix& world, const Matrix& mvp, Float3Stream world_out, ClipStream clip_out)
+{
+	const __m128 w0 = _mm_set1_ps(world.m0), w4 = _mm_set1_ps(world.m4), w8 = _mm_set1_ps(world.m8), w12 = _mm_set1_ps(world.m12);
+	const __m128 w1 = _mm_set1_ps(world.m1), w5 = _mm_set1_ps(world.m5), w9 = _mm_set1_ps(world.m9), w13 = _mm_set1_ps(world.m13);
+	const __m128 w2 = _mm_set1_ps(world.m2), w6 = _mm_set1_ps(world.m6), w10 = _mm_set1_ps(world.m10), w14 = _mm_set1_ps(world.m14);
+
+	const __m128 c0 = _mm_set1_ps(mvp.m0), c4 = _mm_set1_ps(mvp.m4), c8 = _mm_set1_ps(mvp.m8), c12 = _mm_set1_ps(mvp.m12);
+	const __m128 c1 = _mm_set1_ps(mvp.m1), c5 = _mm_set1_ps(mvp.m5), c9 = _mm_set1_ps(mvp.m9), c13 = _mm_set1_ps(mvp.m13);
+	const __m128 c2 = _mm_set1_ps(mvp.m2), c6 = _mm_set1_ps(mvp.m6), c10 = _mm_set1_ps(mvp.m10), c14 = _mm_set1_ps(mvp.m14);
+	const __m128 c3 = _mm_set1_ps(mvp.m3), c7 = _mm_set1_ps(mvp.m7), c11 = _mm_set1_ps(mvp.m11), c15 = _mm_set1_ps(mvp.m15);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128i zero = _mm_setzero_si128();
+
+	for (size_t i = 0; i < count; i += 4)
+	{
+		__m128 x = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(local.x + i)), zero));
+		__m128 y = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(local.y + i)), zero));
+		__m128 z = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(local.z + i)), zero));
+
+		_mm_storeu_ps(world_out.x + i, _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(w0, x), _mm_mul_ps(w4, y)), _mm_mul_ps(w8, z)), w12));
+		_mm_storeu_ps(world_out.y + i, _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(w1, x), _mm_mul_ps(w5, y)), _mm_mul_ps(w9, z)), w13));
+		_mm_storeu_ps(world_out.z + i, _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(w2, x), _mm_mul_ps(w6, y)), _mm_mul_ps(w10, z)), w14));
+
+		__m128 cx = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, x), _mm_mul_ps(c4, y)), _mm_mul_ps(c8, z)), c12);
+		__m128 cy = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c1, x), _mm_mul_ps(c5, y)), _mm_mul_ps(c9, z)), c13);
+		__m128 cz = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c2, x), _mm_mul_ps(c6, y)), _mm_mul_ps(c10, z)), c14);
+		__m128 cw = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(c3, x), _mm_mul_ps(c7, y)), _mm_mul_ps(c11, z)), c15);
+		__m128 inv_w = _mm_div_ps(one, cw);
+
+		_mm_storeu_ps(clip_out.x + i, _mm_mul_ps(cx, inv_w));
+		_mm_storeu_ps(clip_out.y + i, _mm_mul_ps(cy, inv_w));
+		_mm_storeu_ps(clip_out.z + i, _mm_mul_ps(cz, inv_w));
+		_mm_storeu_ps(clip_out.w + i, cw);
+	}
+}
+
+TARGET_AVX2 void TransformQuantizedAVX2(ConstQuantizedStream local, size_t count, const Matrix& world, const Matrix& mvp, Float3Stream world_out, ClipStream clip_out)
+{
+	const __m256 w0 = _mm256_set1_ps(world.m0), w4 = _mm256_set1_ps(world.m4), w8 = _mm256_set1_ps(world.m8), w12 = _mm256_set1_ps(world.m12);
+	const __m256 w1 = _mm256_set1_ps(world.m1), w5 = _mm256_set1_ps(world.m5), w9 = _mm256_set1_ps(world.m9), w13 = _mm256_set1_ps(world.m13);
+	const __m256 w2 = _mm256_set1_ps(world.m2), w6 = _mm256_set1_ps(world.m6), w10 = _mm256_set1_ps(world.m10), w14 = _mm256_set1_ps(world.m14);
+
+	const __m256 c0 = _mm256_set1_ps(mvp.m0), c4 = _mm256_set1_ps(mvp.m4), c8 = _mm256_set1_ps(mvp.m8), c12 = _mm256_set1_ps(mvp.m12);
+	const __m256 c1 = _mm256_set1_ps(mvp.m1), c5 = _mm256_set1_ps(mvp.m5), c9 = _mm256_set1_ps(mvp.m9), c13 = _mm256_set1_ps(mvp.m13);
+	const __m256 c2 = _mm256_set1_ps(mvp.m2), c6 = _mm256_set1_ps(mvp.m6), c10 = _mm256_set1_ps(mvp.m10), c14 = _mm256_set1_ps(mvp.m14);
+	const __m256 c3 = _mm256_set1_ps(mvp.m3), c7 = _mm256_set1_ps(mvp.m7), c11 = _mm256_set1_ps(mvp.m11), c15 = _mm256_set1_ps(mvp.m15);
+	const __m256 one = _mm256_set1_ps(1.0f);
+
+	for (size_t i = 0; i < count; i += 8)
+	{
+		__m256 x = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(local.x + i))));
+		__m256 y = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(local.y + i))));
+		__m256 z = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(local.z + i))));
+
+		_mm256_storeu_ps(world_out.x + i, _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(w0, x), _mm256_mul_ps(w4, y)), _mm256_mul_ps(w8, z)), w12));
+		_mm256_storeu_ps(world_out.y + i, _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(w1, x), _mm256_mul_ps(w5, y)), _mm256_mul_ps(w9, z)), w13));
+		_mm256_storeu_ps(world_out.z + i, _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(w2, x), _mm256_mul_ps(w6, y)), _mm256_mul_ps(w10, z)), w14));
+
+		__m256 cx = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c0, x), _mm256_mul_ps(c4, y)), _mm256_mul_ps(c8, z)), c12);
+		__m256 cy = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c1, x), _mm256_mul_ps(c5, y)), _mm256_mul_ps(c9, z)), c13);
+		__m256 cz = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c2, x), _mm256_mul_ps(c6, y)), _mm256_mul_ps(c10, z)), c14);
+		__m256 cw = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c3, x), _mm256_mul_ps(c7, y)), _mm256_mul_ps(c11, z)), c15);
+		__m256 inv_w = _mm256_div_ps(one, cw);
+
+		_mm256_storeu_ps(clip_out.x + i, _mm256_mul_ps(cx, inv_w));
+		_mm256_storeu_ps(clip_out.y + i, _mm256_mul_ps(cy, inv_w));
+		_mm256_storeu_ps(clip_out.z + i, _mm256_mul_ps(cz, inv_w));
+		_mm256_storeu_ps(clip_out.w + i, cw);
+	}
+}
+
+bool TransformSupportsSSE()
+{
+	return true;
+}
+
+bool TransformSupportsAVX2()
+{
+#if defined(_MSC_VER)
+	// Leaf 7 reports AVX2, but the OS must also save the upper halves of the ymm registers on context switches (OSXSAVE + XCR0)
+	int info[4];
+	__cpuid(info, 1);
+	bool os_saves_ymm = (info[2] & (1 << 27)) && (_xgetbv(0) & 0x6) == 0x6;
+	__cpuidex(info, 7, 0);
+	return os_saves_ymm && (info[1] & (1 << 5));
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#else
+
+// Non-x86 builds (ie Apple silicon) only have the scalar kernel
+void TransformPositionsSSE(ConstFloat3Stream local, size_t count, const Matrix& world, const Matrix& mvp, Float3Stream world_out, ClipStream clip_out)
+{
+	TransformPositionsScalar(local, count, world, mvp, world_out, clip_out);
+}
+
+void TransformPositionsAVX2(ConstFloat3Stream local, size_t count, const Matrix& world, const Matrix& mvp, Float3Stream world_out, ClipStream clip_out)
+{
+	TransformPositionsScalar(local, count, world, mvp, world_out, clip_out);
+}
+
+void TransformQuantizedSSE(ConstQuantizedStream local, size_t count, const Matrix& world, const Matrix& mvp, Float3Stream world_out, ClipStream clip_out)
+{
+	TransformQuantizedScalar(local, count, world, mvp, world_out, clip_out);
+}
+
+void TransformQuantizedAVX2(ConstQuantizedStream local, size_t count, const Matrix& world, const Matrix& mvp, Float3Stream world_out, ClipStream clip_out)
+{
+	TransformQuantizedScalar(local, count, world, mvp, world_out, clip_out);
+}
+
+bool TransformSupportsSSE()
+{
+	return false;
+}
+
+bool TransformSupportsAVX2()
+{
+	return false;
+}
+
+#endif
+
+struct TransformDispatch
+{
+	TransformKernel kernel;
+	QuantizedTransformKernel quantized;
+	const char* name;
+};
+
+static TransformDispatch TransformDetect()
+{
+	if (TransformSupportsAVX2())
+		return { TransformPositionsAVX2, TransformQuantizedAVX2, "AVX2" };
+	if (TransformSupportsSSE())
+		return { TransformPositionsSSE, TransformQuantizedSSE, "SSE" };
+	return { TransformPositionsScalar, TransformQuantizedScalar, "Scalar" };
+}
+
+static const TransformDispatch& TransformGetDispatch()
+{
+	// Thread-safe static initialization, so the first DrawMesh can come from any job
+	static TransformDispatch dispatch = TransformDetect();
+	return dispatch;
+}
+
+TransformKernel TransformGetKernel()
+{
+	return TransformGetDispatch().kernel;
+}
+
+QuantizedTransformKernel TransformGetQuantizedKernel()
+{
+	return TransformGetDispatch().quantized;
+}
+
+const char* TransformGetKernelName()
+{
+	return TransformGetDispatch().name;
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "raymath.h"
+// All "Transform" functions operate on structure-of-arrays vertex streams.
+// Streams must hold a multiple of TRANSFORM_SIMD_WIDTH floats (see MeshBuildSoA) so kernels never need a scalar tail.
+
+constexpr size_t TRANSFORM_SIMD_WIDTH = 8;
+
+struct Float3Stream
+{
+	float* x;
+	float* y;
+	float* z;
+};
+
+// Clip-space positions after the perspective divide, plus the w they were divided by (needed for clipping)
+struct ClipStream
+{
+	float* x;
+	float* y;
+	float* z;
+	float* w;
+};
+
+struct ConstFloat3Stream
+{
+	const float* x;
+	const float* y;
+	const float* z;
+};
+
+// 16-bit integer positions (see MeshQuantize)
+struct ConstQuantizedStream
+{
+	const uint16_t* x;
+	const uint16_t* y;
+	const uint16_t* z;
+};
+
+// Writes local * world to world_out and local * mvp to clip_out for count vertices
+using TransformKernel = void(*)(ConstFloat3Stream local, size_t count, const Matrix& world, const Matrix& mvp, Float3Stream world_out, ClipStream clip_out);
+
+// Reference implementation, matches Vector3Transform and MatrixPerspectiveDivide
+void TransformPositionsScalar(ConstFloat3Stream local, size_t count, const Matrix& world, const Matrix& mvp, Float3Stream world_out, ClipStream clip_out);
+
+// 4 vertices per instruction, available on every x86-64 CPU
+void TransformPositionsSSE(ConstFloat3Stream local, size_t count, const Matrix& world, const Matrix& mvp, Float3Stream world_out, ClipStream clip_out);
+
+// 8 vertices per instruction, only call if TransformSupportsAVX2 returns true
+void TransformPositionsAVX2(ConstFloat3Stream local, size_t count, const Matrix& world, const Matrix& mvp, Float3Stream world_out, ClipStream clip_out);
+
+// The same, for quantized positions. The kernels only widen them to float, so world and mvp must start with the mesh's dequantize matrix
+using QuantizedTransformKernel = void(*)(ConstQuantizedStream local, size_t count, const Matrix& world, const Matrix& mvp, Float3Stream world_out, ClipStream clip_out);
+
+void TransformQuantizedScalar(ConstQuantizedStream local, size_t count, const Matrix& world, const Matrix& mvp, Float3Stream world_out, ClipStream clip_out);
+void TransformQuantizedSSE(ConstQuantizedStream local, size_t count, const Matrix& world, const Matrix& mvp, Float3Stream world_out, ClipStream clip_out);
+void TransformQuantizedAVX2(ConstQuantizedStream local, size_t count, const Matrix& world, const Matrix& mvp, Float3Stream world_out, ClipStream clip_out);
+
+bool TransformSupportsSSE();
+bool TransformSupportsAVX2();
+
+// Fastest kernel the CPU supports, detected on first use
+TransformKernel TransformGetKernel();
+QuantizedTransformKernel TransformGetQuantizedKernel();
+const char* TransformGetKernelName();
+
+inline void TransformPositions(ConstFloat3Stream local, size_t count, const Matrix& world, const Matrix& mvp, Float3Stream world_out, ClipStream clip_out)
+{
+	TransformGetKernel()(local, count, world, mvp, world_out, clip_out);
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+// Growable scratch array aligned to a cache line.
+// Unlike std::vector it never constructs, copies or zero-fills elements and only reallocates when asked for more than its capacity,
+// so once it has grown to fit the largest mesh it is reused every frame without touching the heap.
+template<typename T>
+struct Workspace
+{
+	static_assert(std::is_trivially_copyable<T>::value, "Workspace elements are never constructed or destroyed");
+	static constexpr size_t ALIGNMENT = 64;
+
+	T* data = nullptr;
+	size_t capacity = 0;
+
+	Workspace() = default;
+	Workspace(const Workspace&) = delete;
+	Workspace& operator=(const Workspace&) = delete;
+
+	~Workspace()
+	{
+		Free();
+	}
+
+	// Returns true if the heap was touched. Only the first keep elements are preserved when growing,
+	// since most workspaces are rewritten every frame and copying them would be wasted
+	bool Reserve(size_t count, size_t keep = 0)
+	{
+		if (count <= capacity) return false;
+
+		// Grow by at least 1.5x so meshes of slowly increasing size don't reallocate every frame
+		size_t grown = capacity + capacity / 2;
+		size_t new_capacity = count > grown ? count : grown;
+
+		T* new_data = (T*)::operator new(new_capacity * sizeof(T), std::align_val_t(ALIGNMENT));
+		if (keep > 0)
+			memcpy(new_data, data, keep * sizeof(T));
+		Free();
+		data = new_data;
+		capacity = new_capacity;
+		return true;
+	}
+
+	void Free()
+	{
+		if (data != nullptr)
+			::operator delete(data, std::align_val_t(ALIGNMENT));
+		data = nullptr;
+		capacity = 0;
+	}
+
+	size_t Bytes() const
+	{
+		return capacity * sizeof(T);
+	}
+
+	T& operator[](size_t i) { return data[i]; }
+	const T& operator[](size_t i) const { return data[i]; }
+};
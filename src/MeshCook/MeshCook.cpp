@@ -0,0 +1,541 @@
+// MeshCook -- converts OBJ, PLY and .vbo_nxt meshes into version 2 .vbo_nxt files (see MeshFile.cpp) ahead of time, so MeshImport builds nothing.
+// Corners are welded into shared vertices and LODs are built. Then, for the mesh and each LOD, faces are clustered into meshlets,
+// each meshlet's faces are ordered for the post-transform vertex cache, meshlets are ordered for overdraw, and vertices are renumbered
+// in the order faces first use them. The indexed copy, face normals, meshlets, bounds and BVH are all stored as built.
+// The game draws faces in exactly this order.
+//
+//   MeshCook <input.obj|input.ply|input.vbo_nxt> <output.vbo_nxt>
+#include "Mesh.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+static constexpr int COOK_CACHE_SIZE = 16;	// Post-transform cache entries Tipsify optimizes for
+static constexpr double PLY_MAX_LIST_COUNT = 65536.0;	// Longer lists (ie polygons with more corners) are taken as a corrupt file
+
+struct CookMesh
+{
+	std::vector<Vector3> positions;
+	std::vector<uint32_t> indices;	// 3 per face
+};
+
+static bool EndsWith(const std::string& s, const char* suffix)
+{
+	size_t n = strlen(suffix);
+	if (s.size() < n) return false;
+	for (size_t i = 0; i < n; i++)
+	{
+		if (tolower(s[s.size() - n + i]) != suffix[i]) return false;
+	}
+	return true;
+}
+
+// Polygons are split into fans. Texture coordinate and normal indices are ignored, negative indices count back from the last vertex
+static bool LoadObj(const char* path, CookMesh* mesh)
+{
+	std::ifstream in(path);
+	if (!in) return false;
+
+	std::string line;
+	std::vector<uint32_t> polygon;
+	while (std::getline(in, line))
+	{
+		std::istringstream tokens(line);
+		std::string type;
+		tokens >> type;
+		if (type == "v")
+		{
+			Vector3 p;
+			if (!(tokens >> p.x >> p.y >> p.z)) return false;
+			mesh->positions.push_back(p);
+		}
+		else if (type == "f")
+		{
+			polygon.clear();
+			std::string corner;
+			while (tokens >> corner)
+			{
+				long index = strtol(corner.c_str(), nullptr, 10);
+				long vertex = index < 0 ? (long)mesh->positions.size() + index : index - 1;
+				if (index == 0 || vertex < 0 || vertex >= (long)mesh->positions.size()) return false;
+				polygon.push_back((uint32_t)vertex);
+			}
+			for (size_t i = 2; i < polygon.size(); i++)
+			{
+				mesh->indices.push_back(polygon[0]);
+				mesh->indices.push_back(polygon[i - 1]);
+				mesh->indices.push_back(polygon[i]);
+			}
+		}
+	}
+	return true;
+}
+
+struct PlyProperty
+{
+	std::string name;
+	std::string type;
+	std::string count_type;	// Empty unless the property is a list
+};
+
+struct PlyElement
+{
+	std::string name;
+	size_t count;
+	std::vector<PlyProperty> properties;
+};
+
+static int PlyTypeSize(const std::string& type)
+{
+	if (type == "char" || type == "uchar" || type == "int8" || type == "uint8") return 1;
+	if (type == "short" || type == "ushort" || type == "int16" || type == "uint16") return 2;
+	if (type == "int" || type == "uint" || type == "int32" || type == "uint32" || type == "float" || type == "float32") return 4;
+	if (type == "double" || type == "float64") return 8;
+	return 0;
+}
+
+// Reads one value of type, from text or little-endian binary
+static bool PlyRead(std::istream& in, const std::string& type, bool binary, double* value)
+{
+	if (!binary)
+		return (bool)(in >> *value);
+
+	uint8_t bytes[8];
+	int size = PlyTypeSize(type);
+	if (size == 0 || !in.read((char*)bytes, size)) return false;
+	if (type == "char" || type == "int8") *value = (int8_t)bytes[0];
+	else if (type == "uchar" || type == "uint8") *value = bytes[0];
+	else if (type == "short" || type == "int16") { int16_t v; memcpy(&v, bytes, 2); *value = v; }
+	else if (type == "ushort" || type == "uint16") { uint16_t v; memcpy(&v, bytes, 2); *value = v; }
+	else if (type == "int" || type == "int32") { int32_t v; memcpy(&v, bytes, 4); *value = v; }
+	else if (type == "uint" || type == "uint32") { uint32_t v; memcpy(&v, bytes, 4); *value = v; }
+	else if (type == "float" || type == "float32") { float v; memcpy(&v, bytes, 4); *value = v; }
+	else { double v; memcpy(&v, bytes, 8); *value = v; }
+	return true;
+}
+
+// ASCII and little-endian binary PLY. Only vertex x, y, z and face vertex_indices are kept, every other element and property is skipped
+static bool LoadPly(const char* path, CookMesh* mesh)
+{
+	std::ifstream in(path, std::ios::binary);
+	std::string line;
+	if (!std::getline(in, line) || line.compare(0, 3, "ply") != 0) return false;
+
+	bool binary = false;
+	std::vector<PlyElement> elements;
+	while (std::getline(in, line))
+	{
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		std::istringstream tokens(line);
+		std::string keyword;
+		tokens >> keyword;
+		if (keyword == "format")
+		{
+			std::string format;
+			tokens >> format;
+			if (format == "binary_little_endian") binary = true;
+			else if (format != "ascii") return false;
+		}
+		else if (keyword == "element")
+		{
+			PlyElement element;
+			tokens >> element.name >> element.count;
+			elements.push_back(element);
+		}
+		else if (keyword == "property" && !elements.empty())
+		{
+			PlyProperty property;
+			tokens >> property.type;
+			if (property.type == "list")
+				tokens >> property.count_type >> property.type;
+			tokens >> property.name;
+			elements.back().properties.push_back(property);
+		}
+		else if (keyword == "end_header")
+		{
+			break;
+		}
+	}
+
+	std::vector<double> list;
+	for (const PlyElement& element : elements)
+	{
+		bool vertex = element.name == "vertex";
+		bool face = element.name == "face";
+		for (size_t i = 0; i < element.count; i++)
+		{
+			Vector3 p = Vector3Zeros;
+			for (const PlyProperty& property : element.properties)
+			{
+				double value;
+				if (property.count_type.empty())
+				{
+					if (!PlyRead(in, property.type, binary, &value)) return false;
+					if (vertex && property.name == "x") p.x = (float)value;
+					if (vertex && property.name == "y") p.y = (float)value;
+					if (vertex && property.name == "z") p.z = (float)value;
+					continue;
+				}
+
+				// Counts and indices come from the file, so anything negative, fractional, NaN or out of range is rejected before use
+				double count;
+				if (!PlyRead(in, property.count_type, binary, &count)) return false;
+				if (!(count >= 0.0 && count <= PLY_MAX_LIST_COUNT) || count != floor(count)) return false;
+				list.resize((size_t)count);
+				for (double& v : list)
+				{
+					if (!PlyRead(in, property.type, binary, &v)) return false;
+					if (face && !(v >= 0.0 && v <= UINT32_MAX)) return false;
+				}
+
+				if (!face || (property.name != "vertex_indices" && property.name != "vertex_index")) continue;
+				for (size_t j = 2; j < list.size(); j++)
+				{
+					mesh->indices.push_back((uint32_t)list[0]);
+					mesh->indices.push_back((uint32_t)list[j - 1]);
+					mesh->indices.push_back((uint32_t)list[j]);
+				}
+			}
+			if (vertex)
+				mesh->positions.push_back(p);
+		}
+	}
+
+	for (uint32_t index : mesh->indices)
+	{
+		if (index >= mesh->positions.size()) return false;
+	}
+	return true;
+}
+
+// .vbo_nxt files of either version, so the shipped meshes can be re-cooked. Only the mesh itself is kept, LODs are built again
+static bool LoadVbo(const char* path, CookMesh* mesh)
+{
+	Mesh imported;
+	if (!MeshImport(&imported, path)) return false;
+
+	mesh->positions.resize(imported.vertex_count);
+	for (size_t v = 0; v < imported.vertex_count; v++)
+		mesh->positions[v] = { imported.vertex_x[v], imported.vertex_y[v], imported.vertex_z[v] };
+	if (!imported.indices_16.empty())
+		mesh->indices.assign(imported.indices_16.begin(), imported.indices_16.end());
+	else
+		mesh->indices = imported.indices_32;
+	MeshUnload(&imported);
+	return true;
+}
+
+// Corners at the same position become one vertex, and faces left with a repeated vertex are dropped
+static void Weld(CookMesh* mesh)
+{
+	Mesh soup;
+	MeshTriangulate(&soup, mesh->positions.data(), mesh->indices.data(), mesh->indices.size());
+	MeshWeld(soup, &mesh->positions, &mesh->indices);
+
+	size_t kept = 0;
+	for (size_t i = 0; i < mesh->indices.size(); i += 3)
+	{
+		uint32_t a = mesh->indices[i], b = mesh->indices[i + 1], c = mesh->indices[i + 2];
+		if (a == b || b == c || c == a) continue;
+		mesh->indices[kept++] = a;
+		mesh->indices[kept++] = b;
+		mesh->indices[kept++] = c;
+	}
+	mesh->indices.resize(kept);
+}
+
+// Average cache misses per face for a FIFO cache of COOK_CACHE_SIZE, over faces [begin, end)
+static float CacheMissRatio(const std::vector<uint32_t>& indices, size_t begin, size_t end, size_t vertex_count)
+{
+	std::vector<uint32_t> stamps(vertex_count, 0);
+	uint32_t time = COOK_CACHE_SIZE + 1;
+	size_t misses = 0;
+	for (size_t i = begin * 3; i < end * 3; i++)
+	{
+		uint32_t v = indices[i];
+		if (time - stamps[v] > COOK_CACHE_SIZE)
+		{
+			stamps[v] = time++;
+			misses++;
+		}
+	}
+	return end > begin ? (float)misses / (end - begin) : 0.0f;
+}
+
+// Tipsify (Sander, Nehab & Barczak 2007) -- emits every face around one vertex at a time, moving on to the neighbour that will
+// still be in the cache and has the fewest faces left, so each vertex is transformed about once. Faces are reordered in place
+static void OptimizeVertexCache(std::vector<uint32_t>* face_indices, size_t vertex_count)
+{
+	const std::vector<uint32_t>& indices = *face_indices;
+	size_t face_count = indices.size() / 3;
+
+	std::vector<uint32_t> offsets(vertex_count + 1, 0);
+	for (uint32_t v : indices)
+		offsets[v + 1]++;
+	for (size_t v = 0; v < vertex_count; v++)
+		offsets[v + 1] += offsets[v];
+	std::vector<uint32_t> vertex_faces(indices.size());
+	std::vector<uint32_t> cursors(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < indices.size(); i++)
+		vertex_faces[cursors[indices[i]]++] = (uint32_t)(i / 3);
+
+	std::vector<uint32_t> live(vertex_count);
+	for (size_t v = 0; v < vertex_count; v++)
+		live[v] = offsets[v + 1] - offsets[v];
+
+	std::vector<uint32_t> stamps(vertex_count, 0);
+	std::vector<bool> emitted(face_count, false);
+	std::vector<uint32_t> dead_end;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> order;
+	order.reserve(indices.size());
+
+	uint32_t time = COOK_CACHE_SIZE + 1;
+	size_t scan = 0;
+	int64_t vertex = vertex_count > 0 ? 0 : -1;
+	while (vertex >= 0)
+	{
+		candidates.clear();
+		for (uint32_t k = offsets[vertex]; k < offsets[vertex + 1]; k++)
+		{
+			uint32_t f = vertex_faces[k];
+			if (emitted[f]) continue;
+			emitted[f] = true;
+			for (int j = 0; j < 3; j++)
+			{
+				uint32_t v = indices[f * 3 + j];
+				order.push_back(v);
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (time - stamps[v] > COOK_CACHE_SIZE)
+					stamps[v] = time++;
+			}
+		}
+
+		// Prefer the candidate that entered the cache earliest, as long as all its remaining faces fit before it's evicted
+		int64_t best = -1;
+		int64_t best_priority = -1;
+		for (uint32_t v : candidates)
+		{
+			if (live[v] == 0) continue;
+			int64_t age = time - stamps[v];
+			int64_t priority = age + 2 * (int64_t)live[v] <= COOK_CACHE_SIZE ? age : 0;
+			if (priority > best_priority)
+			{
+				best = v;
+				best_priority = priority;
+			}
+		}
+
+		if (best < 0)
+		{
+			// Dead end -- back up to a recently used vertex with faces left, or failing that the next unfinished vertex
+			while (!dead_end.empty() && best < 0)
+			{
+				uint32_t v = dead_end.back();
+				dead_end.pop_back();
+				if (live[v] > 0)
+					best = v;
+			}
+			while (best < 0 && scan < vertex_count)
+			{
+				if (live[scan] > 0)
+					best = scan;
+				scan++;
+			}
+		}
+		vertex = best;
+	}
+	face_indices->swap(order);
+}
+
+// Tipsify on each meshlet's faces alone, so faces never leave their meshlet. Vertices are numbered within the meshlet for it
+static void OptimizeMeshletCache(CookMesh* mesh)
+{
+	std::vector<uint32_t>& indices = mesh->indices;
+	std::vector<uint32_t> local_index(mesh->positions.size(), ~0u);
+	std::vector<uint32_t> local_indices;
+	std::vector<uint32_t> vertices;
+	for (size_t begin = 0; begin < indices.size(); begin += MESH_MESHLET_FACES * 3)
+	{
+		size_t end = std::min(begin + MESH_MESHLET_FACES * 3, indices.size());
+		local_indices.clear();
+		vertices.clear();
+		for (size_t i = begin; i < end; i++)
+		{
+			uint32_t v = indices[i];
+			if (local_index[v] == ~0u)
+			{
+				local_index[v] = (uint32_t)vertices.size();
+				vertices.push_back(v);
+			}
+			local_indices.push_back(local_index[v]);
+		}
+
+		OptimizeVertexCache(&local_indices, vertices.size());
+		for (size_t i = begin; i < end; i++)
+			indices[i] = vertices[local_indices[i - begin]];
+		for (uint32_t v : vertices)
+			local_index[v] = ~0u;
+	}
+}
+
+// Sander et al.'s overdraw ordering, with meshlets as the clusters -- drawn outermost first (by how far each meshlet's centroid lies
+// along its own normal from the mesh's centroid), since faces on the outside of a mesh tend to hide the ones inside.
+// Every meshlet but the last is full, so the last one stays last and every other keeps its boundaries wherever it moves
+static void OptimizeOverdraw(CookMesh* mesh)
+{
+	size_t face_count = mesh->indices.size() / 3;
+	size_t meshlet_count = (face_count + MESH_MESHLET_FACES - 1) / MESH_MESHLET_FACES;
+	const std::vector<uint32_t>& indices = mesh->indices;
+
+	// Centroids are area weighted, and the summed cross products give an area weighted normal
+	Vector3 mesh_centroid = Vector3Zeros;
+	float mesh_area = 0.0f;
+	std::vector<Vector3> centroids(meshlet_count);
+	std::vector<Vector3> normals(meshlet_count);
+	for (size_t m = 0; m < meshlet_count; m++)
+	{
+		size_t end = std::min((m + 1) * MESH_MESHLET_FACES, face_count);
+		Vector3 centroid = Vector3Zeros;
+		Vector3 normal = Vector3Zeros;
+		float area = 0.0f;
+		for (size_t f = m * MESH_MESHLET_FACES; f < end; f++)
+		{
+			Vector3 p0 = mesh->positions[indices[f * 3 + 0]];
+			Vector3 p1 = mesh->positions[indices[f * 3 + 1]];
+			Vector3 p2 = mesh->positions[indices[f * 3 + 2]];
+			Vector3 cross = Vector3CrossProduct(p1 - p0, p2 - p0);
+			float face_area = Vector3Length(cross) * 0.5f;
+			centroid += (p0 + p1 + p2) * (face_area / 3.0f);
+			normal += cross;
+			area += face_area;
+		}
+		mesh_centroid += centroid;
+		mesh_area += area;
+		centroids[m] = area > 0.0f ? centroid / area : centroid;
+		normals[m] = Vector3Normalize(normal);
+	}
+	mesh_centroid = mesh_area > 0.0f ? mesh_centroid / mesh_area : mesh_centroid;
+
+	std::vector<float> keys(meshlet_count);
+	std::vector<uint32_t> meshlet_order(meshlet_count);
+	for (size_t m = 0; m < meshlet_count; m++)
+	{
+		keys[m] = Vector3DotProduct(centroids[m] - mesh_centroid, normals[m]);
+		meshlet_order[m] = (uint32_t)m;
+	}
+	size_t sorted = face_count % MESH_MESHLET_FACES == 0 ? meshlet_count : meshlet_count - 1;
+	std::stable_sort(meshlet_order.begin(), meshlet_order.begin() + sorted, [&](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+
+	std::vector<uint32_t> order;
+	order.reserve(indices.size());
+	for (uint32_t m : meshlet_order)
+	{
+		size_t end = std::min((m + 1) * MESH_MESHLET_FACES, face_count);
+		order.insert(order.end(), indices.begin() + m * MESH_MESHLET_FACES * 3, indices.begin() + end * 3);
+	}
+	mesh->indices.swap(order);
+}
+
+// Renumbers vertices in the order the faces first use them, so vertex reads walk forward through memory. Unused vertices are dropped
+static void OptimizeVertexFetch(CookMesh* mesh)
+{
+	std::vector<uint32_t> remap(mesh->positions.size(), ~0u);
+	std::vector<Vector3> positions;
+	positions.reserve(mesh->positions.size());
+	for (uint32_t& index : mesh->indices)
+	{
+		if (remap[index] == ~0u)
+		{
+			remap[index] = (uint32_t)positions.size();
+			positions.push_back(mesh->positions[index]);
+		}
+		index = remap[index];
+	}
+	mesh->positions.swap(positions);
+}
+
+// Reorders level's faces and vertices as described at the top, then rebuilds its meshlets' bounds and indexed copy in that order
+static void CookLevel(Mesh* level, const char* name)
+{
+	MeshBuildMeshlets(level);
+	CookMesh mesh;
+	MeshWeld(*level, &mesh.positions, &mesh.indices);
+	size_t face_count = level->face_count;
+	printf("  %s: %zu faces in %zu meshlets, %.3f cache misses per face clustered", name, face_count, level->meshlets.size(),
+		CacheMissRatio(mesh.indices, 0, face_count, mesh.positions.size()));
+
+	OptimizeMeshletCache(&mesh);
+	printf(", %.3f after Tipsify", CacheMissRatio(mesh.indices, 0, face_count, mesh.positions.size()));
+	OptimizeOverdraw(&mesh);
+	printf(", %.3f after overdraw ordering\n", CacheMissRatio(mesh.indices, 0, face_count, mesh.positions.size()));
+	OptimizeVertexFetch(&mesh);
+
+	// Normals and bounds come out the same, the faces and vertices were only reordered
+	MeshTriangulate(level, mesh.positions.data(), mesh.indices.data(), mesh.indices.size());
+	MeshBuildMeshlets(level, false);
+	MeshBuildIndexed(level);
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "usage: %s <input.obj|input.ply|input.vbo_nxt> <output.vbo_nxt>\n", argv[0]);
+		return 1;
+	}
+
+	std::string input = argv[1];
+	CookMesh cook;
+	bool loaded = false;
+	if (EndsWith(input, ".obj"))
+		loaded = LoadObj(argv[1], &cook);
+	else if (EndsWith(input, ".ply"))
+		loaded = LoadPly(argv[1], &cook);
+	else if (EndsWith(input, ".vbo_nxt"))
+		loaded = LoadVbo(argv[1], &cook);
+	else
+	{
+		fprintf(stderr, "%s: unknown format, expected .obj, .ply or .vbo_nxt\n", argv[1]);
+		return 1;
+	}
+	if (!loaded)
+	{
+		fprintf(stderr, "%s: could not be read\n", argv[1]);
+		return 1;
+	}
+
+	printf("%s: %zu vertices, %zu faces\n", argv[1], cook.positions.size(), cook.indices.size() / 3);
+	Weld(&cook);
+	size_t face_count = cook.indices.size() / 3;
+	printf("  welded to %zu vertices, %zu faces, %.3f cache misses per face\n",
+		cook.positions.size(), face_count, CacheMissRatio(cook.indices, 0, face_count, cook.positions.size()));
+
+	Mesh mesh;
+	MeshTriangulate(&mesh, cook.positions.data(), cook.indices.data(), cook.indices.size());
+	MeshBuildLods(&mesh);
+	CookLevel(&mesh, "mesh");
+	for (size_t i = 0; i < mesh.lods.size(); i++)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "LOD %zu", i + 1);
+		CookLevel(&mesh.lods[i], name);
+	}
+	MeshBuildBvh(&mesh);
+
+	if (!MeshExport(argv[2], mesh))
+	{
+		fprintf(stderr, "%s: could not be written\n", argv[2]);
+		return 1;
+	}
+	printf("  wrote %s\n", argv[2]);
+	return 0;
+}